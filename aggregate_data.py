@@ -0,0 +1,346 @@
+import argparse
+import collections
+import heapq
+import os
+import sys
+import threading
+import time
+
+import serial
+
+# Max events a capture file replaying as fast as possible can have waiting for
+# the merge loop.
+REPLAY_MAX_PENDING = 10000
+
+# Aggregates the event streams from several thermostation boards into one time
+# ordered stream. Each board only timestamps its events with microseconds since
+# its own boot, so every board gets a clock model mapping its timestamps onto
+# the host clock, and the aligned events from all boards are merged into a
+# single output.
+#
+# Each board is read by its own thread, which hands lines off to the merge loop
+# through a deque. deque append/popleft are atomic, so with one producer and one
+# consumer per deque no locking is needed. The merge loop buffers events in a
+# heap keyed by aligned time and only emits an event once every active board
+# has reported past it (minus a reorder window), so events that arrive
+# slightly out of order - the firmware prioritizes ext ADC events over the
+# others - still come out in order.
+#
+# Inputs can be serial ports, ptys, or regular files containing a captured
+# device stream, which are replayed at the original rate (or as fast as
+# possible) so the aggregator can be exercised without any boards attached.
+#
+# Output lines are the aligned host timestamp in seconds, the board index, and
+# the original event string:
+# "<host time (float)>,<board (int)>,<event>"
+
+
+# Maps device timestamps onto host time. USB transport only ever adds delay, so
+# the lower envelope of (host receive time - device timestamp) is the best
+# estimate of the clock offset. We take the minimum delay in each bucket of
+# device time and fit a line through the recent bucket minimums, so the model
+# also tracks the drift between the board's crystal and the host clock.
+class ClockModel:
+    def __init__(self, bucket_s=1.0, num_buckets=30):
+        self.bucket_s = bucket_s
+        self.points = collections.deque(maxlen=num_buckets)
+        self.bucket = None
+        self.bucket_min = None
+        self.bucket_dev_s = None
+        self.offset = None
+        self.skew = 0.0
+        self.ref_dev_s = 0.0
+
+    def observe(self, host_s, dev_s):
+        delay = host_s - dev_s
+        bucket = int(dev_s // self.bucket_s)
+        if bucket != self.bucket:
+            if self.bucket is not None:
+                self.points.append((self.bucket_dev_s, self.bucket_min))
+                self.fit()
+            self.bucket = bucket
+            self.bucket_min = delay
+            self.bucket_dev_s = dev_s
+        elif delay < self.bucket_min:
+            self.bucket_min = delay
+            self.bucket_dev_s = dev_s
+
+        # Until we have a full bucket, the best we can do is the minimum
+        # delay so far.
+        if not self.points:
+            self.offset = self.bucket_min
+            self.ref_dev_s = dev_s
+
+    # Least squares line through the bucket minimums.
+    def fit(self):
+        n = len(self.points)
+        if n < 2:
+            self.ref_dev_s, self.offset = self.points[-1]
+            self.skew = 0.0
+            return
+
+        mean_x = sum(p[0] for p in self.points) / n
+        mean_y = sum(p[1] for p in self.points) / n
+        sxx = sum((p[0] - mean_x)**2 for p in self.points)
+        sxy = sum((p[0] - mean_x)*(p[1] - mean_y) for p in self.points)
+        self.skew = sxy/sxx if sxx > 0 else 0.0
+        self.ref_dev_s = mean_x
+        self.offset = mean_y
+
+    def to_host(self, dev_s):
+        return dev_s + self.offset + self.skew*(dev_s - self.ref_dev_s)
+
+
+# Reads one board's event stream in a background thread, handing off
+# (host receive time, device time, event string) tuples through a deque.
+class BoardReader(threading.Thread):
+    def __init__(self, idx, path, replay_rate):
+        super().__init__(daemon=True)
+        self.idx = idx
+        self.path = path
+        self.replay_rate = replay_rate
+        self.out = collections.deque()
+        self.done = False
+        self.malformed = 0
+        self.stop = threading.Event()
+
+    def run(self):
+        try:
+            if os.path.isfile(self.path):
+                self.replay_file()
+            else:
+                self.read_serial()
+        finally:
+            self.done = True
+
+    # Splits out the device timestamp from an event line, returning the device
+    # time in seconds and the event string, or None if it is malformed.
+    def parse(self, line):
+        text = line.decode('utf-8', errors='replace').strip()
+
+        # Only the type and timestamp are needed to merge, the rest of the
+        # event is passed through untouched.
+        elements = text.split(',', 2)
+        if len(elements) < 3:
+            self.malformed += 1
+            return None
+        try:
+            return int(elements[1])/1000000, text
+        except ValueError:
+            self.malformed += 1
+            return None
+
+    def read_serial(self):
+        print(f'Opening serial port {self.path}', file=sys.stderr)
+        ser = serial.Serial(self.path, 115200, timeout=0.1)
+
+        # Read whatever is available in bulk rather than line by line, one
+        # readline() call per event is too slow with many boards. The first
+        # line may be partially complete, so it is discarded.
+        buf = b''
+        first = True
+        while not self.stop.is_set():
+            chunk = ser.read(max(1, ser.in_waiting))
+            if not chunk:
+                continue
+            now = time.monotonic()
+            buf += chunk
+            *lines, buf = buf.split(b'\n')
+            for line in lines:
+                if first:
+                    first = False
+                    continue
+                event = self.parse(line)
+                if event is not None:
+                    self.out.append((now, *event))
+
+    def replay_file(self):
+        # Replay at the original rate, pacing by the device timestamps. A
+        # rate of 0 replays as fast as possible, with the device timestamps
+        # standing in for the host receive times.
+        start_host_s = time.monotonic()
+        start_dev_s = None
+        with open(self.path, 'rb') as f:
+            for line in f:
+                if self.stop.is_set():
+                    break
+                event = self.parse(line)
+                if event is None:
+                    continue
+                dev_s, text = event
+
+                if self.replay_rate <= 0:
+                    # Don't run arbitrarily far ahead of the merge loop.
+                    while len(self.out) > REPLAY_MAX_PENDING:
+                        time.sleep(0.001)
+                    self.out.append((dev_s, dev_s, text))
+                    continue
+
+                if start_dev_s is None:
+                    start_dev_s = dev_s
+                host_s = start_host_s + (dev_s - start_dev_s)/self.replay_rate
+                delay = host_s - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+                self.out.append((time.monotonic(), dev_s, text))
+
+
+# Merges the aligned events from all boards into one time ordered stream with a
+# bounded reorder buffer.
+class Merger:
+    def __init__(self, readers, out, reorder_s, max_buffer, idle_s):
+        self.readers = readers
+        self.out = out
+        self.reorder_s = reorder_s
+        self.max_buffer = max_buffer*len(readers)
+        self.idle_s = idle_s
+        self.clocks = [ClockModel() for _ in readers]
+        self.heap = []
+        self.seq = 0
+        self.latest = [None]*len(readers)
+        self.last_rx = [None]*len(readers)
+        self.finished = [False]*len(readers)
+        self.start_s = time.monotonic()
+        self.last_emitted = float('-inf')
+        self.counts = [0]*len(readers)
+        self.late = 0
+        self.forced = 0
+
+    # Moves everything the readers have handed off into the reorder heap.
+    def drain(self):
+        got = 0
+        now = time.monotonic()
+        for idx, reader in enumerate(self.readers):
+            # Check done before draining, a reader that was already done
+            # can't have handed off anything we don't drain here.
+            self.finished[idx] = reader.done
+            q = reader.out
+            clock = self.clocks[idx]
+            while q:
+                host_s, dev_s, text = q.popleft()
+                clock.observe(host_s, dev_s)
+                t = clock.to_host(dev_s)
+                heapq.heappush(self.heap, (t, self.seq, idx, text))
+                self.seq += 1
+                if self.latest[idx] is None or t > self.latest[idx]:
+                    self.latest[idx] = t
+                self.last_rx[idx] = now
+                self.counts[idx] += 1
+                got += 1
+        return got
+
+    # An event can be emitted once every board that is still sending data
+    # has reported past it by at least the reorder window. Boards that have
+    # gone quiet are left out so one dead board can't stall the others.
+    def watermark(self):
+        now = time.monotonic()
+        mark = float('inf')
+        for idx in range(len(self.readers)):
+            last_rx = self.last_rx[idx]
+            if last_rx is None:
+                if self.finished[idx] or now - self.start_s > self.idle_s:
+                    continue
+                return float('-inf')
+            if self.finished[idx] or now - last_rx > self.idle_s:
+                continue
+            mark = min(mark, self.latest[idx] - self.reorder_s)
+        return mark
+
+    def emit(self, flush=False):
+        mark = float('inf') if flush else self.watermark()
+        lines = []
+        while self.heap:
+            # Past the buffer bound we emit regardless of the watermark,
+            # which may cost some ordering but never unbounded memory.
+            if self.heap[0][0] > mark and len(self.heap) <= self.max_buffer:
+                break
+            if self.heap[0][0] > mark:
+                self.forced += 1
+            t, _, idx, text = heapq.heappop(self.heap)
+            if t < self.last_emitted:
+                self.late += 1
+            else:
+                self.last_emitted = t
+            lines.append(f'{t:.6f},{idx},{text}\n')
+        if lines:
+            self.out.write(''.join(lines))
+
+    def stats(self, elapsed_s):
+        for idx, reader in enumerate(self.readers):
+            clock = self.clocks[idx]
+            offset = clock.offset if clock.offset is not None else float('nan')
+            print(f'Board {idx} ({reader.path}): '
+                  f'{self.counts[idx]/elapsed_s:.0f} events/s, '
+                  f'offset {offset:.6f}s, skew {clock.skew*1e6:.1f}ppm, '
+                  f'{reader.malformed} malformed', file=sys.stderr)
+            self.counts[idx] = 0
+        print(f'Buffered {len(self.heap)}, {self.late} late, '
+              f'{self.forced} forced', file=sys.stderr)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description='Merge event streams from several boards into one '
+                    'time ordered stream.')
+    parser.add_argument('inputs', nargs='+',
+                        help='serial ports, ptys, or capture files to replay')
+    parser.add_argument('-o', '--output',
+                        help='output file, defaults to stdout')
+    parser.add_argument('--reorder-ms', type=float, default=50,
+                        help='how far behind the slowest board events are '
+                             'held for reordering')
+    parser.add_argument('--max-buffer', type=int, default=20000,
+                        help='max buffered events per board')
+    parser.add_argument('--idle-ms', type=float, default=500,
+                        help='boards quiet for this long stop holding up '
+                             'the merge')
+    parser.add_argument('--replay-rate', type=float, default=1.0,
+                        help='playback speed for capture files, 0 replays '
+                             'as fast as possible')
+    parser.add_argument('--stats-s', type=float, default=5.0,
+                        help='seconds between stats printed to stderr, 0 '
+                             'disables them')
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    out = open(args.output, 'w') if args.output else sys.stdout
+
+    readers = [BoardReader(idx, path, args.replay_rate)
+               for idx, path in enumerate(args.inputs)]
+    # Capture files replayed as fast as possible go quiet whenever their
+    # reader thread isn't scheduled, so only stop waiting on them once they
+    # are done.
+    idle_s = args.idle_ms/1000 if args.replay_rate > 0 else float('inf')
+    merger = Merger(readers, out, args.reorder_ms/1000, args.max_buffer,
+                    idle_s)
+    for reader in readers:
+        reader.start()
+
+    last_stats = time.monotonic()
+    try:
+        while True:
+            got = merger.drain()
+            merger.emit()
+
+            now = time.monotonic()
+            if args.stats_s > 0 and now - last_stats > args.stats_s:
+                merger.stats(now - last_stats)
+                last_stats = now
+
+            if got == 0:
+                if all(reader.done for reader in readers):
+                    break
+                time.sleep(0.001)
+    except KeyboardInterrupt:
+        for reader in readers:
+            reader.stop.set()
+
+    merger.drain()
+    merger.emit(flush=True)
+    out.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,159 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "calibration.h"
+
+// Full scale of the RP2040 internal ADC.
+#define ADC_COUNTS (1 << 12)
+
+// Nominal values for a 10k NTC thermistor with a 10k series resistor.
+static const therm_cal_t default_therm_cal = {
+	.series_ohms = 10000.0f,
+	.sh_a = 1.009249522e-3f,
+	.sh_b = 2.378405444e-4f,
+	.sh_c = 2.019202697e-7f,
+};
+
+void calibration_defaults(calibration_t* cal) {
+	cal->active_therm = default_therm_cal;
+	cal->passive_therm = default_therm_cal;
+
+	// Rough fit from the FSR datasheet force vs conductance curve, this
+	// one definitely wants calibrating per-board.
+	cal->fsr = (fsr_cal_t){
+		.series_ohms = 10000.0f,
+		.newtons_per_us = 0.1f,
+		.offset_newtons = 0.0f,
+	};
+}
+
+// Maps a calibration file key to the field it sets. Returns NULL if the key is
+// not recognized.
+static float* calibration_field(calibration_t* cal, const char* key) {
+	const struct {
+		const char* key;
+		float* field;
+	} fields[] = {
+		{"at_series_ohms", &cal->active_therm.series_ohms},
+		{"at_sh_a", &cal->active_therm.sh_a},
+		{"at_sh_b", &cal->active_therm.sh_b},
+		{"at_sh_c", &cal->active_therm.sh_c},
+		{"pt_series_ohms", &cal->passive_therm.series_ohms},
+		{"pt_sh_a", &cal->passive_therm.sh_a},
+		{"pt_sh_b", &cal->passive_therm.sh_b},
+		{"pt_sh_c", &cal->passive_therm.sh_c},
+		{"fsr_series_ohms", &cal->fsr.series_ohms},
+		{"fsr_newtons_per_us", &cal->fsr.newtons_per_us},
+		{"fsr_offset_newtons", &cal->fsr.offset_newtons},
+	};
+
+	for (size_t i = 0; i < sizeof(fields)/sizeof(fields[0]); i++) {
+		if (strcmp(key, fields[i].key) == 0) {
+			return fields[i].field;
+		}
+	}
+	return NULL;
+}
+
+int parse_calibration(calibration_t* cal, const char* text) {
+	int ret = 0;
+	while (*text != '\0') {
+		// Pull out one line at a time, skipping blank lines and comments.
+		const char* end = strchr(text, '\n');
+		size_t len = end ? (size_t)(end - text) : strlen(text);
+		char line[96];
+		if (len >= sizeof(line)) {
+			ret = 1;
+			len = sizeof(line) - 1;
+		}
+		memcpy(line, text, len);
+		line[len] = '\0';
+		text = end ? end + 1 : text + strlen(text);
+
+		char key[32];
+		float value = 0.0f;
+		char first = '\0';
+		if (sscanf(line, " %c", &first) != 1 || first == '#') {
+			continue;
+		}
+		if (sscanf(line, " %31s %f", key, &value) != 2) {
+			ret = 1;
+			continue;
+		}
+
+		float* field = calibration_field(cal, key);
+		if (field == NULL) {
+			ret = 1;
+			continue;
+		}
+		*field = value;
+	}
+	return ret;
+}
+
+int load_calibration(calibration_t* cal, const char* text) {
+	calibration_defaults(cal);
+	if (text == NULL || *text == '\0') {
+		return 0;
+	}
+	if (parse_calibration(cal, text)) {
+		calibration_defaults(cal);
+		return 1;
+	}
+	return 0;
+}
+
+// Returns the ADC counts sampled by the given lookup table entry, clamped to
+// the valid range so the last entry and the open-circuit reading at zero don't
+// divide by zero.
+static int lut_entry_counts(int idx) {
+	int counts = idx << CAL_LUT_SHIFT;
+	if (counts < 1) {
+		counts = 1;
+	}
+	if (counts > ADC_COUNTS - 1) {
+		counts = ADC_COUNTS - 1;
+	}
+	return counts;
+}
+
+// Resistance of the high side of the divider for the given ADC counts.
+static double divider_high_side_ohms(double series_ohms, int counts) {
+	return series_ohms * (ADC_COUNTS - counts) / counts;
+}
+
+void build_therm_lut(const therm_cal_t* cal, cal_lut_t* lut) {
+	for (int i = 0; i < CAL_LUT_SIZE; i++) {
+		const double r = divider_high_side_ohms(cal->series_ohms, lut_entry_counts(i));
+		const double ln_r = log(r);
+		const double inv_t = cal->sh_a + cal->sh_b*ln_r + cal->sh_c*ln_r*ln_r*ln_r;
+		double mdeg_c = (1.0/inv_t - 273.15) * 1000.0;
+
+		if (!(mdeg_c > THERM_MIN_MDEG_C)) {
+			mdeg_c = THERM_MIN_MDEG_C;
+		}
+		if (mdeg_c > THERM_MAX_MDEG_C) {
+			mdeg_c = THERM_MAX_MDEG_C;
+		}
+		lut->y[i] = (int32_t)lround(mdeg_c);
+	}
+}
+
+void build_fsr_lut(const fsr_cal_t* cal, cal_lut_t* lut) {
+	for (int i = 0; i < CAL_LUT_SIZE; i++) {
+		const double r = divider_high_side_ohms(cal->series_ohms, lut_entry_counts(i));
+		const double g_us = 1.0e6 / r;
+		double mn = (cal->offset_newtons + cal->newtons_per_us*g_us) * 1000.0;
+
+		// Force can't be negative, and an FSR with no load is effectively
+		// open circuit, so zero readings rail to zero force.
+		if (i == 0 || mn < 0.0) {
+			mn = 0.0;
+		}
+		if (mn > FSR_MAX_MN) {
+			mn = FSR_MAX_MN;
+		}
+		lut->y[i] = (int32_t)lround(mn);
+	}
+}
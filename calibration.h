@@ -0,0 +1,127 @@
+#ifndef _CALIBRATION_H
+#define _CALIBRATION_H
+
+#include <stdint.h>
+
+// Per-board calibration for the resistive sensors. Each board + sensor combo
+// gets its own set of coefficients, which are loaded once at startup (from a
+// calibration file built into the firmware, see CALIBRATION_FILE in
+// CMakeLists.txt, or the defaults below if there isn't one) and then used to build fixed-point lookup tables indexed directly by raw
+// ADC counts. The sampling interrupt then only has to do a table lookup and a
+// linear interpolation to get degrees C and Newtons, rather than Steinhart-Hart
+// log() math in software floating point on a core with no FPU.
+//
+// The calibration file is a simple text file with one "<key> <value>" pair per
+// line, where lines starting with '#' are comments. Any key that is not
+// present keeps its default value. For example:
+//
+// # Board 3, calibrated 2022-06-14
+// at_series_ohms 10000
+// at_sh_a 1.009249522e-3
+// at_sh_b 2.378405444e-4
+// at_sh_c 2.019202697e-7
+// fsr_newtons_per_us 0.25
+//
+// Valid keys are at_* (active thermistor) and pt_* (passive thermistor) with
+// suffixes series_ohms, sh_a, sh_b, sh_c, and fsr_series_ohms,
+// fsr_newtons_per_us, fsr_offset_newtons.
+
+// Thermistor calibration. The thermistor sits on the high side of a divider
+// with a fixed series resistor to ground, so the ADC voltage rises as the
+// thermistor heats up and its resistance drops. Temperature is computed from
+// resistance with the Steinhart-Hart equation:
+// 1/T = A + B*ln(R) + C*ln(R)^3
+typedef struct therm_cal {
+	float series_ohms;
+	float sh_a;
+	float sh_b;
+	float sh_c;
+} therm_cal_t;
+
+// FSR calibration. The FSR is wired like the thermistors, and its conductance
+// is roughly linear in the applied force, so we fit force as a line in
+// conductance (in microsiemens).
+typedef struct fsr_cal {
+	float series_ohms;
+	float newtons_per_us;
+	float offset_newtons;
+} fsr_cal_t;
+
+// All calibration coefficients for one board.
+typedef struct calibration {
+	therm_cal_t active_therm;
+	therm_cal_t passive_therm;
+	fsr_cal_t fsr;
+} calibration_t;
+
+// The lookup tables have 2^CAL_LUT_BITS segments spanning the 12b ADC range,
+// plus one extra entry so the last segment can be interpolated without a
+// special case. 257 entries per table keeps the interpolation error well
+// under the ADC noise floor while being small enough to sit in RAM.
+#define CAL_LUT_BITS 8
+#define CAL_LUT_SHIFT (12 - CAL_LUT_BITS)
+#define CAL_LUT_SIZE ((1 << CAL_LUT_BITS) + 1)
+
+// Clamp range for the thermistor tables, in milli-degrees C. Outside of this
+// the thermistor is either disconnected or shorted, and the Steinhart-Hart fit
+// is meaningless anyway, so we just rail the output.
+#define THERM_MIN_MDEG_C (-55 * 1000)
+#define THERM_MAX_MDEG_C (200 * 1000)
+
+// Upper rail for the FSR table, in milli-Newtons, about the top of the usable
+// range of a typical FSR. Past this the conductance curve is flat and the fit
+// extrapolates to nonsense, and in practice it means the FSR or its wiring is
+// shorted, so we peg the output here instead.
+#define FSR_MAX_MN (100 * 1000)
+
+// A fixed-point lookup table mapping raw 12b ADC counts to milli-units
+// (milli-degrees C or milli-Newtons).
+typedef struct cal_lut {
+	int32_t y[CAL_LUT_SIZE];
+} cal_lut_t;
+
+// Fills out the calibration struct with nominal values for the parts on the
+// board, used when there is no per-board calibration available.
+void calibration_defaults(calibration_t* cal);
+
+// Parses calibration file contents (a null terminated string) into the given
+// calibration struct, overwriting only the keys present in the file.
+//
+// Returns 0 on success, non-zero if any line was malformed or had an unknown
+// key. Well formed lines are still applied when others fail.
+int parse_calibration(calibration_t* cal, const char* text);
+
+// Contents of the calibration file built into the firmware, an empty string if
+// the build didn't name one. Generated from CALIBRATION_FILE by CMakeLists.txt.
+extern const char board_calibration[];
+
+// Loads the calibration for this board: the defaults, overridden by the keys in
+// the given calibration file contents (NULL or empty for none).
+//
+// Returns 0 on success. If any line of the file is malformed, the whole file is
+// ignored and cal is left with just the defaults, since a half applied
+// calibration is worse than the nominal one, and non-zero is returned.
+int load_calibration(calibration_t* cal, const char* text);
+
+// Builds a lookup table converting ADC counts to milli-degrees C for the given
+// thermistor calibration. Uses floating point math, so should only be called
+// at startup, never from an interrupt.
+void build_therm_lut(const therm_cal_t* cal, cal_lut_t* lut);
+
+// Builds a lookup table converting ADC counts to milli-Newtons for the given
+// FSR calibration. Uses floating point math, so should only be called at
+// startup, never from an interrupt.
+void build_fsr_lut(const fsr_cal_t* cal, cal_lut_t* lut);
+
+// Converts a raw 12b ADC reading to calibrated milli-units with a table lookup
+// and integer linear interpolation between adjacent entries. Cheap enough to
+// call from the sampling interrupts.
+static inline int32_t cal_lut_lookup(const cal_lut_t* lut, uint16_t counts) {
+	const uint32_t idx = (counts & 0xfff) >> CAL_LUT_SHIFT;
+	const int32_t frac = counts & ((1 << CAL_LUT_SHIFT) - 1);
+	const int32_t y0 = lut->y[idx];
+	const int32_t y1 = lut->y[idx + 1];
+	return y0 + (((y1 - y0) * frac) >> CAL_LUT_SHIFT);
+}
+
+#endif // _CALIBRATION_H
@@ -0,0 +1,93 @@
+# Post build check that every function on the sampling interrupt hot path was
+# linked into SRAM, not XIP flash. A hot function in flash still works, it is
+# just slow and jittery whenever it misses the XIP cache, so nothing else would
+# ever catch it.
+#
+# Run as a script with:
+#   ELF        - the linked firmware
+#   NM         - the toolchain's nm
+#   FUNCS      - our hot path functions, comma separated, must be in SRAM
+#   SDK_FUNCS  - SDK functions the hot path calls, comma separated
+#   SDK_IN_RAM - whether the SDK functions must be in SRAM too. If not, the
+#                ones in flash are listed in a warning instead.
+#   INLINE_OK  - functions that may be missing from the symbol table, comma
+#                separated
+#
+# Any other function missing from the symbol table fails the build, so a typo
+# or a rename can't quietly turn the check off for it.
+
+execute_process(
+	COMMAND ${NM} --defined-only ${ELF}
+	OUTPUT_VARIABLE symbols
+	RESULT_VARIABLE ret
+)
+if (NOT ret EQUAL 0)
+	message(FATAL_ERROR "Failed to read symbols from ${ELF}")
+endif()
+
+string(REPLACE "," ";" inline_ok "${INLINE_OK}")
+
+# Finds the listed functions that are in flash, appending their nm lines to
+# the out_var list. Missing functions are appended to the missing list.
+function(find_in_flash funcs_csv out_var)
+	string(REPLACE "," ";" funcs "${funcs_csv}")
+	set(in_flash "")
+	set(missing_funcs "${missing}")
+	foreach(func ${funcs})
+		# GCC may suffix specialized copies of a function, e.g.
+		# .constprop.0, those live in the same section as the original.
+		string(REGEX MATCHALL
+			"(^|\n)[0-9a-fA-F]+ [tTwW] ${func}(\\.[a-z]+\\.[0-9]+)?(\n|$)"
+			matches "${symbols}")
+		if (NOT matches)
+			list(FIND inline_ok ${func} inline_idx)
+			if (NOT inline_idx EQUAL -1)
+				message(STATUS "Hot path function ${func} not found, "
+					"allowed to be inlined")
+			else()
+				list(APPEND missing_funcs ${func})
+			endif()
+			continue()
+		endif()
+
+		# Flash is mapped at 0x10000000 and SRAM at 0x20000000, so the
+		# top hex digit of a function's address says where it runs from.
+		foreach(match ${matches})
+			string(STRIP "${match}" match)
+			string(REGEX REPLACE " .*" "" addr "${match}")
+			string(LENGTH "${addr}" addr_len)
+			if (addr_len EQUAL 8 AND addr MATCHES "^1")
+				list(APPEND in_flash "${match}")
+			endif()
+		endforeach()
+	endforeach()
+	set(${out_var} "${in_flash}" PARENT_SCOPE)
+	set(missing "${missing_funcs}" PARENT_SCOPE)
+endfunction()
+
+set(missing "")
+find_in_flash("${FUNCS}" in_flash)
+find_in_flash("${SDK_FUNCS}" sdk_in_flash)
+
+if (missing)
+	string(REPLACE ";" "\n  " missing "${missing}")
+	message(FATAL_ERROR "Hot path functions not found in ${ELF}:\n"
+		"  ${missing}\n"
+		"Fix the names in CMakeLists.txt, or add them to "
+		"HOT_PATH_INLINE_OK if they are inlined.")
+endif()
+
+if (sdk_in_flash AND NOT SDK_IN_RAM)
+	string(REPLACE ";" "\n  " sdk_list "${sdk_in_flash}")
+	message(WARNING "HOT_PATH_IN_RAM is off, these SDK functions on the "
+		"sampling path run from flash:\n  ${sdk_list}")
+	set(sdk_in_flash "")
+endif()
+
+set(in_flash ${in_flash} ${sdk_in_flash})
+if (in_flash)
+	string(REPLACE ";" "\n  " in_flash "${in_flash}")
+	message(FATAL_ERROR "Hot path functions linked into flash:\n  ${in_flash}\n"
+		"Mark them __time_critical_func, or build with HOT_PATH_IN_RAM "
+		"for SDK functions.")
+endif()
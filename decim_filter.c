@@ -0,0 +1,33 @@
+#include <string.h>
+
+#include "decim_filter.h"
+
+void init_decim_filter(decim_filter_t* filt, int ratio_log2) {
+	memset(filt, 0, sizeof(*filt));
+	if (ratio_log2 < 0) {
+		ratio_log2 = 0;
+	}
+	if (ratio_log2 > DECIM_MAX_RATIO_LOG2) {
+		ratio_log2 = DECIM_MAX_RATIO_LOG2;
+	}
+	filt->ratio_log2 = ratio_log2;
+
+	// Near DC an order N CIC decimating by R droops like
+	// 1 - N*(1 - 1/R^2)*(pi*f)^2/6, with f in cycles per output sample. A
+	// symmetric [b, 1 - 2b, b] FIR rises like 1 - 4*b*(pi*f)^2, so picking
+	// b = -N*(1 - 1/R^2)/24 cancels the droop to second order while keeping
+	// unity gain at DC. Computed in integers, in Q14:
+	// b = -N*(R^2 - 1)/(24*R^2) * 2^14
+	const int64_t r2 = (int64_t)1 << (2*ratio_log2);
+	const int64_t num = (int64_t)DECIM_CIC_ORDER*(r2 - 1) << 14;
+	const int64_t den = 24*r2;
+	filt->fir_side = -(int32_t)((num + den/2)/den);
+	filt->fir_center = (1 << 14) - 2*filt->fir_side;
+}
+
+int decim_filter_delay_x2(const decim_filter_t* filt) {
+	// The CIC delays by N*(R - 1)/2 input samples, and the FIR by 1 output
+	// sample (R input samples).
+	const int ratio = 1 << filt->ratio_log2;
+	return DECIM_CIC_ORDER*(ratio - 1) + 2*ratio;
+}
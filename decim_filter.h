@@ -0,0 +1,109 @@
+#ifndef _DECIM_FILTER_H
+#define _DECIM_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fixed-point decimation filter, used to turn a raw ADC channel into a properly
+// anti-aliased lower rate stream. It is a 3rd order CIC decimator followed by a
+// 3 tap FIR that compensates for the CIC's passband droop:
+//
+// in -> CIC (decimate by 2^ratio_log2) -> compensating FIR -> out
+//
+// The CIC is just adds and subtracts, and with power of two ratios its gain
+// normalization is a shift, so the whole filter costs a handful of adds per
+// input sample plus 2 multiplies per output sample - cheap enough for the
+// sampling interrupt on a core with no FPU and no 64b multiply.
+//
+// Inputs are 12b signed ADC counts. Outputs are in the same units, but with
+// DECIM_FRAC_BITS fractional bits, since averaging buys back some resolution.
+//
+// The filter is plain C with no hardware dependencies so it can be checked
+// against a double precision reference on a host machine.
+#define DECIM_CIC_ORDER 3
+#define DECIM_FRAC_BITS 4
+
+// Largest supported decimation ratio is 2^5 = 32, which keeps the CIC's bit
+// growth (12b input + 3*5b) comfortably inside 32b.
+#define DECIM_MAX_RATIO_LOG2 5
+
+typedef struct decim_filter {
+	// Decimation ratio, as a power of two.
+	int ratio_log2;
+
+	// CIC integrator and comb state. Unsigned so that integrator overflow
+	// is well defined wraparound, which the combs undo exactly.
+	uint32_t integ[DECIM_CIC_ORDER];
+	uint32_t comb[DECIM_CIC_ORDER];
+
+	// Input samples seen since the last output.
+	int phase;
+
+	// Compensating FIR coefficients in Q14, [side, center, side], and the
+	// last 2 CIC outputs.
+	int32_t fir_side;
+	int32_t fir_center;
+	int32_t fir_hist[2];
+} decim_filter_t;
+
+// Cycle budget stats for the filters, reported periodically so we know how
+// much of each sampling period filtering costs.
+typedef struct decim_stats {
+	// Mean and worst case cycles spent filtering one input sample.
+	uint32_t mean_cycles;
+	uint32_t max_cycles;
+
+	// Cycles available per sampling interrupt.
+	uint32_t budget_cycles;
+} decim_stats_t;
+
+// Initializes the filter for the given decimation ratio (as a power of two, 0
+// to DECIM_MAX_RATIO_LOG2), designing the compensating FIR for it and
+// resetting the filter state.
+void init_decim_filter(decim_filter_t* filt, int ratio_log2);
+
+// Group delay of the filter in input samples, times 2 since it is a multiple of
+// one half. Used to correct output timestamps.
+int decim_filter_delay_x2(const decim_filter_t* filt);
+
+// Pushes one input sample through the filter. Every 2^ratio_log2 inputs, an
+// output is ready - then this returns true and writes it to out. Integer only,
+// safe to call from an interrupt.
+static inline bool decim_filter_push(decim_filter_t* filt, int32_t in, int32_t* out) {
+	filt->integ[0] += (uint32_t)in;
+	filt->integ[1] += filt->integ[0];
+	filt->integ[2] += filt->integ[1];
+
+	if (++filt->phase < (1 << filt->ratio_log2)) {
+		return false;
+	}
+	filt->phase = 0;
+
+	// Comb stages run at the output rate.
+	uint32_t y = filt->integ[2];
+	for (int i = 0; i < DECIM_CIC_ORDER; i++) {
+		const uint32_t prev = filt->comb[i];
+		filt->comb[i] = y;
+		y -= prev;
+	}
+
+	// Normalize the CIC gain of ratio^order down to DECIM_FRAC_BITS
+	// fractional bits, with rounding.
+	const int shift = DECIM_CIC_ORDER*filt->ratio_log2 - DECIM_FRAC_BITS;
+	int32_t cic = (int32_t)y;
+	if (shift > 0) {
+		cic = (cic + (1 << (shift - 1))) >> shift;
+	} else {
+		cic <<= -shift;
+	}
+
+	// Symmetric 3 tap compensator.
+	const int32_t acc = filt->fir_side*(cic + filt->fir_hist[1]) +
+		filt->fir_center*filt->fir_hist[0];
+	filt->fir_hist[1] = filt->fir_hist[0];
+	filt->fir_hist[0] = cic;
+	*out = (acc + (1 << 13)) >> 14;
+	return true;
+}
+
+#endif // _DECIM_FILTER_H
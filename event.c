@@ -31,15 +31,18 @@ bool read_event_bus(event_bus_t* eb, event_t* event) {
 	return false;
 }
 
-bool write_event_bus(event_bus_t* eb, event_t* event) {
-	// Route external adc data events to the high speed queue. Since they
-	// are acquired in a more frequent interrupt, we don't want to risk
-	// blocking for the low-frequency interrupt to complete, dropping a few
-	// samples. Depending on the exact implementation details of the queues
-	// and the spinlocks they use, it might be OK to merge these queues,
-	// there just wasn't a lot of docs on how to prevent priority inversion
-	// with these queues.
-	if (event->type == EVENT_EXT_ADC) {
+bool __time_critical_func(write_event_bus)(event_bus_t* eb, event_t* event) {
+	// Route external adc data events (raw or decimated, and the filter
+	// stats) to the high speed queue. Since they are acquired in a more
+	// frequent interrupt, we don't want to risk blocking for the
+	// low-frequency interrupt to complete, dropping a few samples.
+	// Depending on the exact implementation details of the queues and the
+	// spinlocks they use, it might be OK to merge these queues, there just
+	// wasn't a lot of docs on how to prevent priority inversion with these
+	// queues.
+	if (event->type == EVENT_EXT_ADC ||
+			event->type == EVENT_EXT_ADC_DECIM ||
+			event->type == EVENT_DECIM_STATS) {
 		return queue_try_add(&eb->hs_fifo, event);
 	} else {
 		return queue_try_add(&eb->ls_fifo, event);
@@ -58,8 +61,9 @@ bool serialize_event(event_t* event, char* buf, size_t buf_size) {
 					event->ext_adc.data);
 			return !(ret < 0) && !(ret >= buf_size);
 		case EVENT_IMU:
-			ret = snprintf(buf, buf_size, "1,%lld,%f,%f,%f,%f,%f,%f",
+			ret = snprintf(buf, buf_size, "1,%lld,%d,%f,%f,%f,%f,%f,%f",
 					event->timestamp_us,
+					event->imu.id,
 					event->imu.accel.x,
 					event->imu.accel.y,
 					event->imu.accel.z,
@@ -68,11 +72,59 @@ bool serialize_event(event_t* event, char* buf, size_t buf_size) {
 					event->imu.gyro.z);
 			return !(ret < 0) && !(ret >= buf_size);
 		case EVENT_RES:
-			ret = snprintf(buf, buf_size, "2,%lld,%f,%f,%f",
+			ret = snprintf(buf, buf_size, "2,%lld,%f,%f,%f,%.3f,%.3f,%.3f",
 					event->timestamp_us,
-					event->res.active_therm_volts,
-					event->res.passive_therm_volts,
-					event->res.fsr_volts);
+					res_sensor_counts_to_volts(event->res.active_therm_counts),
+					res_sensor_counts_to_volts(event->res.passive_therm_counts),
+					res_sensor_counts_to_volts(event->res.fsr_counts),
+					event->res.active_therm_mdeg_c / 1000.0f,
+					event->res.passive_therm_mdeg_c / 1000.0f,
+					event->res.fsr_mn / 1000.0f);
+			return !(ret < 0) && !(ret >= buf_size);
+		case EVENT_THERM_CTRL:
+			ret = snprintf(buf, buf_size, "4,%lld,%.3f,%.3f,%.3f,%.4f",
+					event->timestamp_us,
+					event->therm_ctrl.setpoint_mdeg_c / 1000.0f,
+					event->therm_ctrl.measured_mdeg_c / 1000.0f,
+					event->therm_ctrl.error_mdeg_c / 1000.0f,
+					event->therm_ctrl.duty / (float)THERM_CTRL_DUTY_ONE);
+			return !(ret < 0) && !(ret >= buf_size);
+		case EVENT_IMU_BUS:
+			ret = snprintf(buf, buf_size, "5,%lld,%d,%lu,%lu,%lu",
+					event->timestamp_us,
+					event->imu_bus.num_imus,
+					event->imu_bus.mean_us,
+					event->imu_bus.max_us,
+					event->imu_bus.budget_us);
+			return !(ret < 0) && !(ret >= buf_size);
+		case EVENT_SENSOR_ERR:
+			ret = snprintf(buf, buf_size, "6,%lld,%d,%d,%d",
+					event->timestamp_us,
+					event->sensor_err.source,
+					event->sensor_err.id,
+					event->sensor_err.code);
+			return !(ret < 0) && !(ret >= buf_size);
+		case EVENT_EXT_ADC_DECIM:
+			ret = snprintf(buf, buf_size, "7,%lld,%d,%.4f",
+					event->timestamp_us,
+					event->ext_adc_decim.channel,
+					event->ext_adc_decim.data / (float)(1 << DECIM_FRAC_BITS));
+			return !(ret < 0) && !(ret >= buf_size);
+		case EVENT_DECIM_STATS:
+			ret = snprintf(buf, buf_size, "8,%lld,%lu,%lu,%lu",
+					event->timestamp_us,
+					event->decim_stats.mean_cycles,
+					event->decim_stats.max_cycles,
+					event->decim_stats.budget_cycles);
+			return !(ret < 0) && !(ret >= buf_size);
+		case EVENT_ISR_STATS:
+			ret = snprintf(buf, buf_size, "9,%lld,%d,%ld,%lu,%lu,%lu",
+					event->timestamp_us,
+					event->isr_stats.isr,
+					event->isr_stats.max_latency_us,
+					event->isr_stats.mean_us,
+					event->isr_stats.max_us,
+					event->isr_stats.budget_us);
 			return !(ret < 0) && !(ret >= buf_size);
 		case EVENT_DBG:
 			ret = snprintf(buf, buf_size, "3,%lld,%s",
@@ -3,9 +3,11 @@
 
 #include "pico/util/queue.h"
 
+#include "decim_filter.h"
 #include "ext_adc.h"
 #include "imu.h"
 #include "resistive_sensors.h"
+#include "therm_ctrl.h"
 
 // The event system is used to safely process events generated in interrupts on
 // one core, and process them in an event loop on another core of the RP2040,
@@ -39,15 +41,23 @@ typedef enum event_type {
 	// Event with IMU data
 	//
 	// Serialized (a for accel data, g for gyro data):
-	// "1,<timestamp (uint64_t)>,<a.x (float)>,<a.y (float)>,<a.z (float)>,
-	// <g.x (float)>,<g.y (float)>,<g.z (float)>"
+	// "1,<timestamp (uint64_t)>,<imu id (int)>,<a.x (float)>,<a.y (float)>,
+	// <a.z (float)>,<g.x (float)>,<g.y (float)>,<g.z (float)>"
 	EVENT_IMU = 1,
 
 	// Event with resistive sensor data
 	//
+	// The active thermistor can't be measured while it heats, so its
+	// values are the controller's latest measurement from the start of the
+	// current control period, not from this event's timestamp. They lag it
+	// by up to one control period (20ms). EVENT_THERM_CTRL carries the same
+	// measurement stamped when it was taken.
+	//
 	// Serialized:
 	// "2,<timestamp (uint64_t)>,<active therm volts (float)>,
-	// <passive therm volts (float)>,<fsr volts (float)>"
+	// <passive therm volts (float)>,<fsr volts (float)>,
+	// <active therm deg C (float)>,<passive therm deg C (float)>,
+	// <fsr Newtons (float)>"
 	EVENT_RES = 2,
 
 	// Event with a debug log to forward to the host
@@ -56,8 +66,87 @@ typedef enum event_type {
 	// "3,<timestamp (uint64_t)>,
 	// <message (ascii string terminated by newline)>"
 	EVENT_DBG = 3,
+
+	// Event with active thermistor controller telemetry, duty is the
+	// fraction of the control period spent heating.
+	//
+	// Serialized:
+	// "4,<timestamp (uint64_t)>,<setpoint deg C (float)>,
+	// <measured deg C (float)>,<error deg C (float)>,<duty 0-1 (float)>"
+	EVENT_THERM_CTRL = 4,
+
+	// Event with IMU I2C bus occupancy stats, sent periodically. Times are
+	// per low speed tick, in microseconds.
+	//
+	// Serialized:
+	// "5,<timestamp (uint64_t)>,<num imus (int)>,<mean us (uint32_t)>,
+	// <max us (uint32_t)>,<budget us (uint32_t)>"
+	EVENT_IMU_BUS = 5,
+
+	// Event reporting a sensor fault or recovery. The source is the event
+	// type of the affected sensor's samples, and the id says which instance
+	// (e.g. the IMU id). The code is the negative pico error code that
+	// caused the fault, or 0 when the sensor has recovered (or, for an IMU
+	// missing at startup, first responded).
+	//
+	// Serialized:
+	// "6,<timestamp (uint64_t)>,<source (int)>,<id (int)>,<code (int)>"
+	EVENT_SENSOR_ERR = 6,
+
+	// Event with a decimated, anti-aliased external ADC sample. Sent
+	// instead of the raw EVENT_EXT_ADC events when decimation is enabled.
+	// The timestamp is corrected for the filter's group delay.
+	//
+	// Serialized:
+	// "7,<timestamp (uint64_t)>,<channel (int)>,<data counts (float)>"
+	EVENT_EXT_ADC_DECIM = 7,
+
+	// Event with ext ADC decimation filter cycle budget stats, sent
+	// periodically. Cycles are per input sample, the budget is the cycles
+	// per ext ADC conversion.
+	//
+	// Serialized:
+	// "8,<timestamp (uint64_t)>,<mean cycles (uint32_t)>,
+	// <max cycles (uint32_t)>,<budget cycles (uint32_t)>"
+	EVENT_DECIM_STATS = 8,
+
+	// Event with timing stats for one sampling interrupt, sent
+	// periodically for each. The latency is the worst case delay from when
+	// the interrupt was due to when its handler started, or -1 for
+	// interrupts raised by external hardware, where we can't tell when the
+	// edge happened (see ext_adc_drdy_callback() for the ext ADC's bound).
+	// The mean and max are the time spent in the handler, against the
+	// budget for it.
+	//
+	// Serialized:
+	// "9,<timestamp (uint64_t)>,<isr (int)>,<max latency us (int32_t)>,
+	// <mean us (uint32_t)>,<max us (uint32_t)>,<budget us (uint32_t)>"
+	EVENT_ISR_STATS = 9,
 } event_type_t;
 
+// Data for an EVENT_SENSOR_ERR event.
+typedef struct sensor_err {
+	event_type_t source;
+	int id;
+	int code;
+} sensor_err_t;
+
+// Identifies the sampling interrupt in an EVENT_ISR_STATS event.
+typedef enum isr_id {
+	ISR_EXT_ADC = 0,
+	ISR_LS_TIMER = 1,
+	ISR_THERM_CTRL = 2,
+} isr_id_t;
+
+// Data for an EVENT_ISR_STATS event.
+typedef struct isr_stats {
+	isr_id_t isr;
+	int32_t max_latency_us;
+	uint32_t mean_us;
+	uint32_t max_us;
+	uint32_t budget_us;
+} isr_stats_t;
+
 // The events are tagged unions, each event type corresponds to some kind of
 // sample from a sensor. The sampling interrupts write events to the event bus,
 // and the event loop reads and serializes them (doing costly string formatting
@@ -71,7 +160,13 @@ typedef struct event {
 	union {
 		imu_sample_t imu;
 		ext_adc_sample_t ext_adc;
+		ext_adc_decim_sample_t ext_adc_decim;
+		decim_stats_t decim_stats;
 		res_sensor_sample_t res;
+		therm_ctrl_sample_t therm_ctrl;
+		imu_bus_stats_t imu_bus;
+		sensor_err_t sensor_err;
+		isr_stats_t isr_stats;
 		char* dbg_msg;
 	};
 } event_t;
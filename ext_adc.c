@@ -1,14 +1,10 @@
+#include "pico/stdlib.h"
+
 #include "hardware/gpio.h"
 #include "hardware/spi.h"
 
 #include "ext_adc.h"
 
-// Pins for ADS1018-Q1 SPI interface
-#define EXT_ADC_PIN_MISO 19
-#define EXT_ADC_PIN_CS 17
-#define EXT_ADC_PIN_SCK 18
-#define EXT_ADC_PIN_MOSI 16
-
 // Channel mux config bits. We only use the top few values but the valid mux
 // bits are:
 // 000 = AINP is AIN0 and AINN is AIN1 (default)
@@ -41,17 +37,29 @@
 #define EXT_ADC_GAIN_512mV 4
 #define EXT_ADC_GAIN_256mV 5
 
+// SPI clock. The ADS1018-Q1's minimum SCLK period is 250ns, and none of its
+// other timing requirements depend on the clock rate, so 4MHz is the fastest
+// valid clock. A 32b transaction then takes 8us of each ~300us conversion.
+#define EXT_ADC_SPI_HZ (4*1000*1000)
+
+// Nominal time between conversions. The ADS1018-Q1's internal oscillator is
+// only good to 10%, so this is just for spotting missed conversions.
+#define EXT_ADC_CONVERSION_US (1000000/EXT_ADC_SPS)
+
+// Config register bits that read back as written. The start bit always reads
+// back 0 in continuous mode, and the reserved bit 0 reads back either way.
+#define EXT_ADC_CONFIG_READBACK_MASK 0x7ffe
+
 // Helper to build a config register value, encapsulating all the hardcoded
 // offsets from the ADS1018-Q1 datasheet. The ADS1018-Q1 has just 15 config
 // bits, so rather than a typical register map type interface where you'd have
 // to write a minimum of one register address byte and one register data byte,
 // it just has you write the the whole 16b on every SPI transaction each time.
-static inline uint16_t ext_adc_config(bool start, int mux, int gain) {
+static inline uint16_t ext_adc_config(int mux, int gain) {
 	uint16_t config = 0;
 
-	// Writing a one here will trigger the next conversion to start in
-	// single-shot mode.
-	config |= (start ? 1 : 0) << 15;
+	// The start bit only does anything in single-shot mode, leave it 0.
+	config |= 0 << 15;
 
 	// Set the mux to the desired channel.
 	config |= (mux & 7) << 12;
@@ -60,13 +68,13 @@ static inline uint16_t ext_adc_config(bool start, int mux, int gain) {
 	config |= (gain & 7) << 9;
 
 	// Set the mode to either continuos (0) or single-shot (1). We always
-	// want single-shot so we can control the rate with a timer interrupt.
-	config |= 1 << 8;
+	// want continuous so the ADC paces sampling itself, and a new result is
+	// ready the moment DOUT/DRDY falls.
+	config |= 0 << 8;
 
 	// Set the sample rate, which sets how long each conversion will take.
-	// The longer the conversion, the less noise and power consumption, so
-	// we want this to be the smallest value that's greater than
-	// (4 channels)*(500 samples/s), or 2400sps, from the given options:
+	// In continuous mode this is also the rate samples are delivered at,
+	// split over the 4 channels. EXT_ADC_DR picks one of:
 	// 000 = 128 SPS
 	// 001 = 250 SPS
 	// 010 = 490 SPS
@@ -75,7 +83,7 @@ static inline uint16_t ext_adc_config(bool start, int mux, int gain) {
 	// 101 = 2400 SPS
 	// 110 = 3300 SPS
 	// 111 = Not Used
-	config |= 6 << 5;
+	config |= EXT_ADC_DR << 5;
 
 	// Never read internal temp sensor, temp sensor bit can be
 	// 0 = ADC mode (default)
@@ -97,6 +105,11 @@ static inline int adc_channel_to_channel_num(int adc_ch) {
 	return adc_ch - 4;
 }
 
+// Helper to convert a channel number to the ADS1018-Q1 mux setting for it.
+static inline int channel_num_to_adc_channel(int channel) {
+	return channel + EXT_ADC_CH0;
+}
+
 // Software managed chip select - set CS low to begin a SPI transaction.
 static inline void ext_adc_select(void) {
 	gpio_put(EXT_ADC_PIN_CS, 0);
@@ -107,21 +120,53 @@ static inline void ext_adc_deselect(void) {
 	gpio_put(EXT_ADC_PIN_CS, 1);
 }
 
+// Does one 32b transaction: clocks out the last conversion result while
+// writing the given config, then writes the config again while clocking out
+// the config register readback. The ADS1018-Q1 is the only device on the bus,
+// so CS stays low between transactions - DOUT/DRDY only signals new data while
+// CS is low.
+static inline void ext_adc_transfer(uint16_t config, int16_t* data,
+		uint16_t* readback) {
+	const uint16_t tx[2] = {config, config};
+	uint16_t rx[2];
+	spi_write16_read16_blocking(spi0, tx, rx, 2);
+	*data = (int16_t)rx[0];
+	*readback = rx[1];
+}
+
+// Restarts conversions from CH0 with the readback pipeline empty. Pulsing CS
+// high resets the ADS1018-Q1's serial interface, in case it lost track of where
+// it was in a transaction.
+static void __time_critical_func(ext_adc_restart)(ext_adc_t* ext_adc) {
+	ext_adc_deselect();
+	busy_wait_us_32(1);
+	ext_adc_select();
+
+	const uint16_t config = ext_adc_config(EXT_ADC_CH0, EXT_ADC_GAIN_4V);
+	int16_t data;
+	uint16_t readback;
+	ext_adc_transfer(config, &data, &readback);
+
+	// If even this config didn't read back, leave the pipeline empty so no
+	// result is tagged with it.
+	ext_adc->readback_mux[0] = (readback >> 12) & 7;
+	const uint16_t mask = EXT_ADC_CONFIG_READBACK_MASK;
+	ext_adc->pipeline_fill = (readback & mask) == (config & mask) ? 1 : 0;
+	ext_adc->next_channel = 1;
+	ext_adc->last_read_us = time_us_32();
+	gpio_acknowledge_irq(EXT_ADC_PIN_DRDY, GPIO_IRQ_EDGE_FALL);
+}
+
 void init_ext_adc(ext_adc_t* ext_adc) {
-	// Connected to SPI0, 900kHz
-	//
-	// TODO: Optimize clock rate - we can go faster but the datasheet
-	// mentioned maybe adding some delays between successive readings in
-	// some cases with SPI clocks >1MHz, so we shoudl check on that before
-	// increasing.
-	spi_init(spi0, 900*1000);
+	spi_init(spi0, EXT_ADC_SPI_HZ);
 
 	// The ADS1018-Q1 supports 16b and 32b transactions, and wants SPI mode
 	// 1 where the clock  idles low and data is sampled on the falling
-	// clock edges.
+	// clock edges. We do 32b transactions as two 16b frames.
 	spi_set_format(spi0, 16, SPI_CPOL_0, SPI_CPHA_1, SPI_MSB_FIRST);
 
-	// Set up pinmux to connect pins to SPI bus.
+	// Set up pinmux to connect pins to SPI bus. MISO doubles as DRDY, gpio
+	// edge interrupts still see the pin while it's muxed to SPI.
 	gpio_set_function(EXT_ADC_PIN_MISO, GPIO_FUNC_SPI);
 	gpio_set_function(EXT_ADC_PIN_SCK, GPIO_FUNC_SPI);
 	gpio_set_function(EXT_ADC_PIN_MOSI, GPIO_FUNC_SPI);
@@ -130,43 +175,77 @@ void init_ext_adc(ext_adc_t* ext_adc) {
 	gpio_init(EXT_ADC_PIN_CS);
 	gpio_set_dir(EXT_ADC_PIN_CS, GPIO_OUT);
 
-	// Set channel to 0 in our internal state, and go ahead and configure
-	// the ADS1018-Q1 to the desired settings and begin the CH0 conversion
-	// so that the CH0 sample is ready later and we can start the normal
-	// read cycle in an interrupt.
-	const uint16_t initial_config = ext_adc_config(true, EXT_ADC_CH0, EXT_ADC_GAIN_4V); 
-	ext_adc_select();
-	spi_write16_blocking(spi0, &initial_config, 1); 
-	ext_adc_deselect();
+	// Configure the ADS1018-Q1 for continuous conversions starting with
+	// CH0, after which every DRDY falling edge has a result for us.
+	ext_adc_restart(ext_adc);
 }
 
-int read_ext_adc(ext_adc_t* ext_adc, ext_adc_sample_t* sample) {
-	// Each time we read from the SPI bus, we write in a configuration used
-	// for the next conversion, so the first time we read we need to select
-	// CH1 in the mux, that way we read CH1 the next read.
-	const int next_channel_map[4] = {
-		EXT_ADC_CH1,
-		EXT_ADC_CH2,
-		EXT_ADC_CH3,
-		EXT_ADC_CH0,
-	};
-
-	const int curr_channel = ext_adc->current_channel;
-	const int next_channel = next_channel_map[curr_channel];
-
-	const uint16_t config = ext_adc_config(true, next_channel, EXT_ADC_GAIN_4V); 
+int __time_critical_func(read_ext_adc)(ext_adc_t* ext_adc,
+		ext_adc_sample_t* sample) {
+	const int mux = channel_num_to_adc_channel(ext_adc->next_channel);
+	const uint16_t config = ext_adc_config(mux, EXT_ADC_GAIN_4V);
 	int16_t data = 0;
-	ext_adc_select();
-	spi_write16_read16_blocking(spi0, &config, &data, 1); 
-	ext_adc_deselect();
+	uint16_t readback = 0;
+	const uint32_t now_us = time_us_32();
+	const uint32_t since_last_us = now_us - ext_adc->last_read_us;
+	ext_adc_transfer(config, &data, &readback);
+	ext_adc->last_read_us = now_us;
+
+	// Clocking the data out toggles DOUT/DRDY, which latches bogus falling
+	// edges. The next real one can't come for another conversion period.
+	gpio_acknowledge_irq(EXT_ADC_PIN_DRDY, GPIO_IRQ_EDGE_FALL);
+
+	// If the config didn't read back as written then either the write was
+	// dropped or we're out of step with the ADC, and we can't trust which
+	// channel anything in the pipeline came from.
+	const uint16_t mask = EXT_ADC_CONFIG_READBACK_MASK;
+	if ((readback & mask) != (config & mask)) {
+		ext_adc_restart(ext_adc);
+		return PICO_ERROR_IO;
+	}
+
+	// The channel comes from the config the ADC actually had when this
+	// conversion started, not from what we think we wrote.
+	const int result_mux = ext_adc->readback_mux[EXT_ADC_PIPELINE_DEPTH - 1];
+	for (int i = EXT_ADC_PIPELINE_DEPTH - 1; i > 0; i--) {
+		ext_adc->readback_mux[i] = ext_adc->readback_mux[i - 1];
+	}
+	ext_adc->readback_mux[0] = (readback >> 12) & 7;
+	ext_adc->next_channel = (ext_adc->next_channel + 1) % EXT_ADC_NUM_CHANNELS;
+
+	if (ext_adc->pipeline_fill < EXT_ADC_PIPELINE_DEPTH) {
+		ext_adc->pipeline_fill++;
+		return EXT_ADC_NO_SAMPLE;
+	}
+
+	// If we were late enough to miss a conversion, the ADC has moved on to
+	// the last mux we wrote early and this result could be from either
+	// setting, so drop it. The pipeline itself is still in step, the
+	// conversion in progress now uses the mux from the last transaction
+	// either way.
+	if (since_last_us > (3*EXT_ADC_CONVERSION_US)/2) {
+		return EXT_ADC_NO_SAMPLE;
+	}
 
 	// This is only a 12 bit ADC with the data left aligned, so we shift by
 	// 4b to right align the data to be in the expected 0-4095 range.
-	sample->channel = curr_channel;
+	sample->channel = adc_channel_to_channel_num(result_mux);
 	sample->data = data >> 4;
-
-	// Update internal state for next reading.
-	ext_adc->current_channel = adc_channel_to_channel_num(next_channel);
-
 	return 0;
 }
+
+bool __time_critical_func(ext_adc_check_stalled)(ext_adc_t* ext_adc) {
+	if (time_us_32() - ext_adc->last_read_us < EXT_ADC_STALL_US) {
+		return false;
+	}
+
+	// The DRDY interrupt may preempt us, so keep it off while we restart,
+	// and check again in case it fired in the meantime.
+	gpio_set_irq_enabled(EXT_ADC_PIN_DRDY, GPIO_IRQ_EDGE_FALL, false);
+	const bool stalled = time_us_32() - ext_adc->last_read_us >= EXT_ADC_STALL_US;
+	if (stalled) {
+		ext_adc_restart(ext_adc);
+	}
+	gpio_set_irq_enabled(EXT_ADC_PIN_DRDY, GPIO_IRQ_EDGE_FALL, true);
+	return stalled;
+}
@@ -1,6 +1,9 @@
 #ifndef _EXT_ADC_H
 #define _EXT_ADC_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 // The external ADC is an ADS1018-Q1 connected over SPI. It is a very simple
 // device that reads only one channel at a time through an analog mux,
 // requiring us to manually switch the mux each time a sample is read. That
@@ -10,11 +13,70 @@
 // for each channel are not synced, and are slightly out of phase with
 // eachother, but that doesn't matter too much for our application. We just
 // have to keep track of a little state on the mcu and sample faster.
+//
+// The ADC runs in continuous conversion mode and paces acquisition itself:
+// with CS held low, its DOUT/DRDY pin (our SPI MISO) falls each time a
+// conversion completes, and that edge interrupt reads the result. Each read is
+// a 32 bit transaction that also reads back the config register, so the
+// channel each result belongs to comes from the ADC rather than from our idea
+// of what we last wrote.
+
+// Pins for ADS1018-Q1 SPI interface. DOUT/DRDY shares the SPI MISO pin.
+#define EXT_ADC_PIN_MISO 19
+#define EXT_ADC_PIN_CS 17
+#define EXT_ADC_PIN_SCK 18
+#define EXT_ADC_PIN_MOSI 16
+#define EXT_ADC_PIN_DRDY EXT_ADC_PIN_MISO
+
+// Data rate config bits written by ext_adc_config(). We use the fastest rate.
+#define EXT_ADC_DR 6
+
+// Conversion rate for each data rate config value.
+#define EXT_ADC_DR_SPS(dr) \
+	((dr) == 0 ? 128 : \
+	 (dr) == 1 ? 250 : \
+	 (dr) == 2 ? 490 : \
+	 (dr) == 3 ? 920 : \
+	 (dr) == 4 ? 1600 : \
+	 (dr) == 5 ? 2400 : \
+	 (dr) == 6 ? 3300 : 0)
+
+// Conversion rate in continuous mode, split round-robbin over the channels.
+// Everything timed off the ADC (the stall detector, decimation delay and ISR
+// budget) derives from this, so change EXT_ADC_DR rather than this.
+#define EXT_ADC_SPS EXT_ADC_DR_SPS(EXT_ADC_DR)
+#if EXT_ADC_SPS == 0
+#error "EXT_ADC_DR is not a valid ADS1018 data rate"
+#endif
+
+// Conversions are overdue if DRDY hasn't fired for this long, over a dozen
+// conversion periods.
+#define EXT_ADC_STALL_US 5000
+
+// In continuous mode the next conversion has already started by the time we
+// read a result and write a new mux, so a mux write only applies to the
+// conversion after that. The result read in a transaction was converted with
+// the mux read back this many transactions earlier.
+#define EXT_ADC_PIPELINE_DEPTH 2
+
+// read_ext_adc() return value for a successful read whose channel isn't known
+// for certain.
+#define EXT_ADC_NO_SAMPLE 1
+
 typedef struct ext_adc {
-	// Keeps track of the "current channel", which was written into the ADC
-	// config register, so that when the next sample is read out, it will
-	// correspond with the "current channel".
-	int current_channel;
+	// Channel to write into the config register with the next read.
+	int next_channel;
+
+	// Mux settings read back from the config register in the last
+	// EXT_ADC_PIPELINE_DEPTH transactions, [0] is the latest.
+	int readback_mux[EXT_ADC_PIPELINE_DEPTH];
+
+	// Transactions since the last (re)start, results aren't tagged with a
+	// channel until the readback pipeline has filled.
+	int pipeline_fill;
+
+	// Time of the last transaction, for stall detection.
+	uint32_t last_read_us;
 } ext_adc_t;
 
 // Holds the sample data for the external ADC. Each sample is associated with a
@@ -24,16 +86,39 @@ typedef struct ext_adc_sample {
 	int16_t data;
 } ext_adc_sample_t;
 
-// Initializes SPI interface to communicate with the ADS1018-Q1, and
-// initializes the instance data.
+// Number of external ADC channels sampled round-robbin.
+#define EXT_ADC_NUM_CHANNELS 4
+
+// Holds a decimated, filtered sample for one channel. The data is in ADC
+// counts with DECIM_FRAC_BITS fractional bits (see decim_filter.h).
+typedef struct ext_adc_decim_sample {
+	int channel;
+	int32_t data;
+} ext_adc_decim_sample_t;
+
+// Initializes SPI interface to communicate with the ADS1018-Q1, initializes
+// the instance data, and starts continuous conversions. The caller enables the
+// falling edge interrupt on EXT_ADC_PIN_DRDY, since the gpio interrupt
+// callback is shared by all pins.
 void init_ext_adc(ext_adc_t* ext_adc);
 
-// Reads one sample from the ADS1018-Q1, which will be written into the given
-// sample struct. It is expected that this will be periodically called in an
-// interrupt to sample the ADC at a known, constant rate. This will update the
-// ADS1018-Q1's mux and begin collecting the next sample.
+// Reads one conversion result from the ADS1018-Q1, which will be written into
+// the given sample struct, and writes the mux for a later conversion. Must be
+// called from the DRDY falling edge interrupt, it acknowledges the edges that
+// reading the data clocks out on DOUT/DRDY.
 //
-// Returns 0 on success, non-zero on failure.
+// Returns 0 if a sample was read, EXT_ADC_NO_SAMPLE if the read succeeded but
+// the result's channel isn't certain (just after a (re)start, or after a missed
+// conversion), or a negative pico error code if the
+// config readback didn't match what was written. In that case the ADC has been
+// resynced and the sample should be dropped.
 int read_ext_adc(ext_adc_t* ext_adc, ext_adc_sample_t* sample);
 
+// Resyncs the ADC if DRDY hasn't fired for EXT_ADC_STALL_US, which can happen
+// if a DRDY edge was missed. Call periodically from a lower priority interrupt
+// than the DRDY one, the DRDY interrupt is disabled while resyncing.
+//
+// Returns true if the ADC was stalled and has been resynced.
+bool ext_adc_check_stalled(ext_adc_t* ext_adc);
+
 #endif // _EXT_ADC_H
@@ -3,12 +3,18 @@
 #include "pico/multicore.h"
 #include "pico/stdlib.h"
 
+#include "hardware/clocks.h"
 #include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/structs/systick.h"
 
+#include "calibration.h"
+#include "decim_filter.h"
 #include "event.h"
 #include "ext_adc.h"
 #include "imu.h"
 #include "resistive_sensors.h"
+#include "therm_ctrl.h"
 
 
 // I2C addresses for MPU-6050s
@@ -22,39 +28,381 @@
 
 #define TIMER_RATE_HZ 500
 
+// Decimation ratio for the ext ADC channels, as a power of two. Each channel
+// is run through a CIC + compensating FIR decimator and only the decimated
+// samples are sent, 0 disables filtering and sends every raw sample instead.
+#define EXT_ADC_DECIM_RATIO_LOG2 2
+
+// Decimation filter cycle stats are accumulated over this many ext ADC
+// conversions (1 second) before being reported.
+#define DECIM_STATS_TICKS EXT_ADC_SPS
+
+// IMU bus occupancy stats are accumulated over this many low speed ticks (1
+// second) before being reported.
+#define IMU_BUS_STATS_TICKS TIMER_RATE_HZ
+
+// How often the background loop checks for stuck IMU buses and IMUs due for a
+// retry or probe. Matches the shortest retry backoff.
+#define IMU_RECOVERY_INTERVAL_US IMU_RETRY_MIN_US
+
+// Active thermistor temperature setpoint, in milli-degrees C. With the default
+// calibration this is about where the old 1.8 V threshold sat.
+#define ACTIVE_THERM_SETPOINT_MDEG_C 30000
+
+// The active thermistor controller runs on its own timer, independent of the
+// sensor logging rate. Each control period starts with a measurement, then the
+// heater is switched on for the commanded fraction of the period. The thermal
+// time constant is on the order of seconds, so 50Hz is plenty.
+#define THERM_CTRL_RATE_HZ 50
+#define THERM_CTRL_PERIOD_US (1000000/THERM_CTRL_RATE_HZ)
+
+// Headroom at the end of each control period where we never heat, so the heat
+// off alarm always fires before the next measurement is due even with some
+// timer jitter.
+#define THERM_CTRL_GUARD_US 100
+
+// Heater on-times shorter than this aren't worth scheduling an alarm for.
+#define THERM_CTRL_MIN_ON_US 20
+
+// Time budget for each sampling interrupt handler. The ext ADC interrupt has
+// the highest priority, so its worst case adds straight onto every other
+// interrupt's latency and it has to stay short. The low speed tick has to fit
+// every IMU read timing out back to back.
+#define EXT_ADC_ISR_BUDGET_US 25
+#define LS_ISR_BUDGET_US (NUM_IMUS*IMU_READ_BUDGET_US + 100)
+#define THERM_CTRL_ISR_BUDGET_US 25
+
 // Global struct instances are shared between the ISRs and in the case of the
 // event bus, even the second core.
+//
+// All the state only the sampling interrupts touch lives in the SCRATCH_Y SRAM
+// bank, next to core 0's stack. Core 1's stack is in SCRATCH_X and the event
+// bus queues are in the striped main banks, so the only memory core 1's
+// serialization loop shares with the interrupts is the queues themselves. The
+// calibration tables are too big to fit alongside the stack and stay in main
+// SRAM, they are only ever read.
 event_bus_t event_bus;
-ext_adc_t ext_adc;
-imu_inst_t imu0;
-imu_inst_t imu1;
-
-// This high speed timer callback runs 4x faster than the low speed one, to
-// acquire external adc channels at the same rate.
-static bool hs_timer_callback(repeating_timer_t *rt){
-	// Read ext adc data into event.
+ext_adc_t __scratch_y("isr") ext_adc;
+decim_filter_t __scratch_y("isr") ext_adc_filters[EXT_ADC_NUM_CHANNELS];
+
+// Group delay of the ext ADC decimation filters, the same for every channel.
+// Worked out once up front, it costs a divide.
+uint32_t __scratch_y("isr") ext_adc_decim_delay_us;
+
+// Set by the first ext ADC error, stall or readback mismatch, and cleared by
+// the next good sample. Errors are only reported when it is first set and
+// recovery when it is cleared, so a dead or glitching ADC sends one error per
+// fault rather than one per DRDY edge or low speed tick.
+volatile bool __scratch_y("isr") ext_adc_faulted;
+
+imu_bus_stats_t __scratch_y("isr") imu_bus_stats;
+
+// Low speed ticks so far. The background waits for this to change before
+// touching an IMU bus, so it has the bus to itself until the next tick.
+volatile uint32_t __scratch_y("isr") ls_ticks;
+
+// Table of IMU instances, all read each low speed tick. IMUs sharing an I2C
+// bus are read back to back with one burst transaction each, and each IMU's
+// samples are tagged with its id so it gets its own stream on the host. IMU 0
+// is mounted to the PCB, IMU 1 is attached through the connector on the same
+// bus with AD0 pulled high. IMUs on different buses just need a different i2c
+// instance and pins here.
+imu_inst_t __scratch_y("isr") imus[] = {
+	{
+		.i2c = i2c1,
+		.bus_addr = IMU_ADDR,
+		.scl_pin = IMU_SCL,
+		.sda_pin = IMU_SDA,
+		.id = 0,
+	},
+	{
+		.i2c = i2c1,
+		.bus_addr = IMU2_ADDR,
+		.scl_pin = IMU_SCL,
+		.sda_pin = IMU_SDA,
+		.id = 1,
+	},
+};
+#define NUM_IMUS (sizeof(imus)/sizeof(imus[0]))
+therm_ctrl_t __scratch_y("isr") therm_ctrl;
+
+// Timing state for one sampling interrupt, see isr_enter() and isr_exit().
+typedef struct isr_timing {
+	isr_id_t isr;
+	uint32_t budget_us;
+
+	// Period of a timer interrupt and when its next callback is due, used
+	// to measure how late the callback starts. The period is 0 for
+	// interrupts from external hardware.
+	uint32_t period_us;
+	uint64_t next_due_us;
+
+	// Handler calls per report (1 second's worth), and the stats
+	// accumulated since the last report.
+	uint32_t report_ticks;
+	uint32_t ticks;
+	uint32_t total_us;
+	uint32_t max_us;
+	int32_t max_latency_us;
+} isr_timing_t;
+
+isr_timing_t __scratch_y("isr") ext_adc_isr_timing;
+isr_timing_t __scratch_y("isr") ls_isr_timing;
+isr_timing_t __scratch_y("isr") therm_ctrl_isr_timing;
+
+// Reads the SysTick counter, which counts down from 2^24 - 1 at the system
+// clock rate. Used to time short sections of code in cycles.
+static inline uint32_t read_cycles(void) {
+	return systick_hw->cvr;
+}
+
+// Sets up an interrupt's timing state. Timer interrupts must be set up right
+// before their timer is added, so the first callback is due one period from
+// now.
+static void init_isr_timing(isr_timing_t* timing, isr_id_t isr,
+		uint32_t budget_us, uint32_t period_us, uint32_t report_ticks) {
+	*timing = (isr_timing_t){
+		.isr = isr,
+		.budget_us = budget_us,
+		.period_us = period_us,
+		.next_due_us = time_us_64() + period_us,
+		.report_ticks = report_ticks,
+		.max_latency_us = period_us ? 0 : -1,
+	};
+}
+
+// Called first thing in an interrupt handler, records how late a timer
+// interrupt started. Returns the start time to pass to isr_exit().
+static uint64_t __time_critical_func(isr_enter)(isr_timing_t* timing) {
+	const uint64_t now_us = time_us_64();
+	if (timing->period_us) {
+		// Repeating timers with negative delays are due exactly one
+		// period after the last one was due, however late it ran.
+		const int32_t latency_us = (int32_t)(now_us - timing->next_due_us);
+		if (latency_us > timing->max_latency_us) {
+			timing->max_latency_us = latency_us;
+		}
+		timing->next_due_us += timing->period_us;
+	}
+	return now_us;
+}
+
+// Called last thing in an interrupt handler, accumulates the time spent in it
+// and periodically reports the stats.
+static void __time_critical_func(isr_exit)(isr_timing_t* timing,
+		uint64_t start_us) {
+	const uint32_t elapsed_us = (uint32_t)(time_us_64() - start_us);
+	timing->ticks++;
+	timing->total_us += elapsed_us;
+	if (elapsed_us > timing->max_us) {
+		timing->max_us = elapsed_us;
+	}
+	if (timing->ticks < timing->report_ticks) {
+		return;
+	}
+
 	event_t event;
-	event.type = EVENT_EXT_ADC;
-	if (read_ext_adc(&ext_adc, &event.ext_adc)) {
-		printf("ERR - failed to read ext ADC\r\n");
+	event.type = EVENT_ISR_STATS;
+	event.isr_stats = (isr_stats_t){
+		.isr = timing->isr,
+		.max_latency_us = timing->max_latency_us,
+		.mean_us = timing->total_us / timing->ticks,
+		.max_us = timing->max_us,
+		.budget_us = timing->budget_us,
+	};
+	event.timestamp_us = to_us_since_boot(get_absolute_time());
+	if (!write_event_bus(&event_bus, &event)) {
+		printf("ERR - failed to write low speed event\r\n");
+	}
+
+	timing->ticks = 0;
+	timing->total_us = 0;
+	timing->max_us = 0;
+	timing->max_latency_us = timing->period_us ? 0 : -1;
+}
+
+// Accumulates the cycles spent filtering one ext ADC sample, and periodically
+// reports the mean and worst case against the per-tick budget.
+static void __time_critical_func(update_decim_stats)(uint32_t cycles) {
+	static uint32_t __scratch_y("isr") ticks = 0;
+	static uint32_t __scratch_y("isr") total_cycles = 0;
+	static uint32_t __scratch_y("isr") max_cycles = 0;
+
+	ticks++;
+	total_cycles += cycles;
+	if (cycles > max_cycles) {
+		max_cycles = cycles;
+	}
+	if (ticks < DECIM_STATS_TICKS) {
+		return;
 	}
 
-	// Timestamp the event then write it onto the event bus for eventual
-	// serialization and transmission/logging.
+	event_t event;
+	event.type = EVENT_DECIM_STATS;
+	event.decim_stats = (decim_stats_t){
+		.mean_cycles = total_cycles / ticks,
+		.max_cycles = max_cycles,
+		.budget_cycles = clock_get_hz(clk_sys) / EXT_ADC_SPS,
+	};
 	event.timestamp_us = to_us_since_boot(get_absolute_time());
 	if (!write_event_bus(&event_bus, &event)) {
 		printf("ERR - failed to write high speed event\r\n");
 	}
 
-	// Returning true from a pico "timer alarm callback" means that we want
-	// the callback to keep running - definitely return true here or this
-	// will only run once!
-	return true;
+	ticks = 0;
+	total_cycles = 0;
+	max_cycles = 0;
+}
+
+// Reports a sensor fault (negative pico error code) or recovery (0) to the
+// host.
+static void __time_critical_func(write_sensor_err_event)(event_type_t source,
+		int id, int code) {
+	event_t event;
+	event.type = EVENT_SENSOR_ERR;
+	event.sensor_err = (sensor_err_t){
+		.source = source,
+		.id = id,
+		.code = code,
+	};
+	event.timestamp_us = to_us_since_boot(get_absolute_time());
+	if (!write_event_bus(&event_bus, &event)) {
+		printf("ERR - failed to write low speed event\r\n");
+	}
+}
+
+// Reports an ext ADC error, unless it is already faulted.
+//
+// This runs from both the DRDY interrupt and the low speed timer interrupt.
+// DRDY can preempt the timer between the test and the set here, so in a rare
+// race a stall is reported just as a good sample came in. Only the DRDY path
+// clears the flag, so the next good sample still reports the recovery and the
+// host always sees matching fault/recovery pairs.
+static void __time_critical_func(report_ext_adc_fault)(int code) {
+	if (ext_adc_faulted) {
+		return;
+	}
+	ext_adc_faulted = true;
+	write_sensor_err_event(EVENT_EXT_ADC, 0, code);
+}
+
+// Reads and filters one ext ADC conversion result.
+static void __time_critical_func(sample_ext_adc)(uint64_t timestamp_us) {
+	event_t event;
+	event.type = EVENT_EXT_ADC;
+	event.timestamp_us = timestamp_us;
+	const int ret = read_ext_adc(&ext_adc, &event.ext_adc);
+	if (ret == EXT_ADC_NO_SAMPLE) {
+		return;
+	}
+	if (ret) {
+		report_ext_adc_fault(ret);
+		return;
+	}
+	if (ext_adc_faulted) {
+		ext_adc_faulted = false;
+		write_sensor_err_event(EVENT_EXT_ADC, 0, 0);
+	}
+
+	// Without decimation, write the raw event onto the event bus for
+	// eventual serialization and transmission/logging.
+	if (EXT_ADC_DECIM_RATIO_LOG2 == 0) {
+		if (!write_event_bus(&event_bus, &event)) {
+			printf("ERR - failed to write high speed event\r\n");
+		}
+		return;
+	}
+
+	// Otherwise run the sample through its channel's decimation filter,
+	// and only send the filter output when there is one. The output
+	// timestamp is pulled back by the filter's group delay so it lines up
+	// with the other sensors.
+	const int channel = event.ext_adc.channel;
+	decim_filter_t* filt = &ext_adc_filters[channel];
+	int32_t filtered = 0;
+	const uint32_t start = read_cycles();
+	const bool ready = decim_filter_push(filt, event.ext_adc.data, &filtered);
+	update_decim_stats((start - read_cycles()) & 0x00ffffff);
+	if (ready) {
+		event_t decim_event;
+		decim_event.type = EVENT_EXT_ADC_DECIM;
+		decim_event.ext_adc_decim = (ext_adc_decim_sample_t){
+			.channel = channel,
+			.data = filtered,
+		};
+		decim_event.timestamp_us = event.timestamp_us - ext_adc_decim_delay_us;
+		if (!write_event_bus(&event_bus, &decim_event)) {
+			printf("ERR - failed to write high speed event\r\n");
+		}
+	}
+}
+
+// Runs on every DOUT/DRDY falling edge from the ext ADC, as soon as a
+// conversion completes, so the ADC's own conversion clock paces acquisition.
+// The ADC cycles through the channels, so each channel is sampled at
+// EXT_ADC_SPS/EXT_ADC_NUM_CHANNELS.
+static void __time_critical_func(ext_adc_drdy_callback)(uint gpio,
+		uint32_t events) {
+	if (gpio != EXT_ADC_PIN_DRDY) {
+		return;
+	}
+
+	// The entry time doubles as the sample timestamp, the conversion
+	// finished right at the edge.
+	//
+	// Nothing records when the edge itself happened, so this interrupt's
+	// latency isn't measured and is reported as -1. It is bounded though:
+	// it is the only interrupt at the highest priority, so it can only be
+	// held off by the IRQ entry and gpio dispatch and by code running with
+	// interrupts disabled. On core 0 that is the SDK's short spinlock
+	// sections, like the event bus queues copying one event in or the
+	// timer alarm pool.
+	const uint64_t start_us = isr_enter(&ext_adc_isr_timing);
+	sample_ext_adc(start_us);
+	isr_exit(&ext_adc_isr_timing, start_us);
+}
+
+// Accumulates the time spent reading IMUs this tick, and periodically reports
+// the mean and worst case.
+static void __time_critical_func(update_imu_bus_stats)(uint32_t elapsed_us) {
+	static uint32_t __scratch_y("isr") ticks = 0;
+	static uint32_t __scratch_y("isr") total_us = 0;
+	static uint32_t __scratch_y("isr") max_us = 0;
+
+	ticks++;
+	total_us += elapsed_us;
+	if (elapsed_us > max_us) {
+		max_us = elapsed_us;
+	}
+	if (ticks < IMU_BUS_STATS_TICKS) {
+		return;
+	}
+
+	event_t event;
+	event.type = EVENT_IMU_BUS;
+	event.imu_bus = imu_bus_stats;
+	event.imu_bus.num_imus = 0;
+	for (size_t i = 0; i < NUM_IMUS; i++) {
+		if (imus[i].state == IMU_OK) {
+			event.imu_bus.num_imus++;
+		}
+	}
+	event.imu_bus.mean_us = total_us / ticks;
+	event.imu_bus.max_us = max_us;
+	event.timestamp_us = to_us_since_boot(get_absolute_time());
+	if (!write_event_bus(&event_bus, &event)) {
+		printf("ERR - failed to write low speed event\r\n");
+	}
+
+	ticks = 0;
+	total_us = 0;
+	max_us = 0;
 }
 
-// This low speed timer callback runs at 500Hz and reads most of the sensors,
-// as well as handles the active thermistor control loop.
-static bool ls_timer_callback(repeating_timer_t *rt){
+// This low speed timer callback runs at 500Hz and reads most of the sensors.
+static bool __time_critical_func(ls_timer_callback)(repeating_timer_t *rt){
+	const uint64_t start_us = isr_enter(&ls_isr_timing);
+
 	// Read resistive sensor data into an event and write it.
 	event_t res_event;
 	res_event.type = EVENT_RES;
@@ -66,25 +414,40 @@ static bool ls_timer_callback(repeating_timer_t *rt){
 		printf("ERR - failed to write low speed event\r\n");
 	}
 
-	// Handle the active thermistor temperature control here. If it's below
-	// the threshold, set it to heat.
-	//
-	// TODO: configure this in degrees C from the SD card settings or over
-	// the serial console or something.
-	if (res_event.res.active_therm_volts < 1.8f) {
-		set_active_therm_heat(true);
+	// The ext ADC is paced by its own DRDY edges, if they stop coming it
+	// needs a kick.
+	if (ext_adc_check_stalled(&ext_adc)) {
+		report_ext_adc_fault(PICO_ERROR_TIMEOUT);
 	}
 
-	// Read resistive sensor data into an event and write it.
-	event_t imu0_event;
-	imu0_event.type = EVENT_IMU;
-	if (read_imu(&imu0, &imu0_event.imu)) {
-		printf("ERR - failed to read imu\r\n");
-	}
-	imu0_event.timestamp_us = to_us_since_boot(get_absolute_time());
-	if (!write_event_bus(&event_bus, &imu0_event)) {
-		printf("ERR - failed to write low speed event\r\n");
+	// Read each connected IMU into an event and write it, keeping track of
+	// how long we spend on the bus. IMUs that aren't working are just
+	// skipped, bringing them back is left to the background.
+	const uint32_t imu_start_us = time_us_32();
+	for (size_t i = 0; i < NUM_IMUS; i++) {
+		imu_inst_t* imu = &imus[i];
+		if (!imu_ready(imu)) {
+			continue;
+		}
+
+		// A failed read marks the IMU as faulted so it is skipped until
+		// a retry brings it back, so this is reported once per fault
+		// rather than every tick.
+		event_t imu_event;
+		imu_event.type = EVENT_IMU;
+		const int ret = read_imu(imu, &imu_event.imu);
+		if (ret) {
+			write_sensor_err_event(EVENT_IMU, imu->id, ret);
+			continue;
+		}
+		imu_event.timestamp_us = to_us_since_boot(get_absolute_time());
+		if (!write_event_bus(&event_bus, &imu_event)) {
+			printf("ERR - failed to write low speed event\r\n");
+		}
 	}
+	update_imu_bus_stats(time_us_32() - imu_start_us);
+	ls_ticks++;
+	isr_exit(&ls_isr_timing, start_us);
 
 	// Returning true from a pico "timer alarm callback" means that we want
 	// the callback to keep running - definitely return true here or this
@@ -92,6 +455,49 @@ static bool ls_timer_callback(repeating_timer_t *rt){
 	return true;
 }
 
+// Ends the heating portion of a control period.
+static int64_t __time_critical_func(therm_heat_off_callback)(alarm_id_t id,
+		void *user_data) {
+	set_active_therm_heat(false);
+
+	// Returning 0 from an alarm callback means don't reschedule it.
+	return 0;
+}
+
+// This timer callback runs the active thermistor control loop. The heater is
+// time-proportioned: each period we measure first, while the heater is still
+// off from the end of the last period, then heat for the commanded duty
+// fraction of the period. That way measuring only costs a few microseconds of
+// heating per period.
+static bool __time_critical_func(therm_ctrl_timer_callback)(
+		repeating_timer_t *rt){
+	const uint64_t start_us = isr_enter(&therm_ctrl_isr_timing);
+
+	event_t event;
+	event.type = EVENT_THERM_CTRL;
+	const int32_t measured = measure_active_therm();
+	therm_ctrl_update(&therm_ctrl, measured, &event.therm_ctrl);
+
+	const uint32_t on_us = ((uint64_t)event.therm_ctrl.duty *
+		THERM_CTRL_PERIOD_US) / THERM_CTRL_DUTY_ONE;
+	if (on_us >= THERM_CTRL_MIN_ON_US) {
+		set_active_therm_heat(true);
+		if (add_alarm_in_us(on_us, therm_heat_off_callback, NULL, true) < 0) {
+			// Never leave the heater stuck on.
+			set_active_therm_heat(false);
+			printf("ERR - failed to add heat off alarm\r\n");
+		}
+	}
+
+	event.timestamp_us = to_us_since_boot(get_absolute_time());
+	if (!write_event_bus(&event_bus, &event)) {
+		printf("ERR - failed to write therm ctrl event\r\n");
+	}
+
+	isr_exit(&therm_ctrl_isr_timing, start_us);
+	return true;
+}
+
 // This runs forever processing events from the event bus, serializing them and
 // logging them over the uart and onto the SD card.
 static void event_loop() {
@@ -120,34 +526,178 @@ static void event_loop() {
 }
 
 
+// Clears and re-initializes any stuck I2C bus with a faulted IMU on it,
+// reporting the IMUs that came back. A faulted IMU on a bus that isn't stuck is
+// left to retry_faulted_imus(), so the healthy IMUs on the bus keep being
+// sampled. Runs from the background loop, never the ISRs.
+static void recover_stuck_imu_buses(void) {
+	// Each bus is only recovered once per pass, even with several faulted
+	// IMUs on it.
+	bool attempted[NUM_I2CS] = {false};
+	for (size_t i = 0; i < NUM_IMUS; i++) {
+		i2c_inst_t* i2c = imus[i].i2c;
+		if (imus[i].state != IMU_FAULT || attempted[i2c_hw_index(i2c)]) {
+			continue;
+		}
+		attempted[i2c_hw_index(i2c)] = true;
+		if (!imu_bus_stuck(&imus[i])) {
+			continue;
+		}
+
+		// Remember what was faulted on this bus, recovery may bring back
+		// more than one IMU at once.
+		bool faulted[NUM_IMUS];
+		for (size_t j = 0; j < NUM_IMUS; j++) {
+			faulted[j] = imus[j].state == IMU_FAULT;
+		}
+
+		recover_imu_bus(i2c, imus, NUM_IMUS);
+		for (size_t j = 0; j < NUM_IMUS; j++) {
+			if (imus[j].i2c == i2c && faulted[j] && imus[j].state == IMU_OK) {
+				write_sensor_err_event(EVENT_IMU, imus[j].id, 0);
+			}
+		}
+	}
+}
+
+// Waits for a low speed tick to finish. The ticks are the only other users of
+// the IMU buses, so a transaction started right after one has the bus to itself
+// until the next.
+static void wait_for_ls_tick(void) {
+	const uint32_t ticks = ls_ticks;
+	while (ls_ticks == ticks) {
+		tight_loop_contents();
+	}
+}
+
+// Flags the working IMUs sharing a bus with one that just came back from a
+// fault to be checked for a reset, the same glitch may have reset them too.
+static void check_imus_for_reset(const imu_inst_t* recovered) {
+	for (size_t i = 0; i < NUM_IMUS; i++) {
+		if (&imus[i] != recovered && imus[i].i2c == recovered->i2c &&
+				imus[i].state == IMU_OK) {
+			imus[i].check_reset = true;
+		}
+	}
+}
+
+// Retries faulted IMUs and probes absent ones that are due, reporting the ones
+// that came back, then checks the other IMUs on their bus for a reset. Each
+// probe or check is started right after a low speed tick and fits in the gap
+// before the next (IMU_RETRY_BUDGET_US), so the working IMUs on the bus don't
+// miss a sample. Runs from the background loop, never the ISRs.
+static void retry_faulted_imus(void) {
+	for (size_t i = 0; i < NUM_IMUS; i++) {
+		imu_inst_t* imu = &imus[i];
+		if (!imu_retry_due(imu)) {
+			continue;
+		}
+		wait_for_ls_tick();
+		if (retry_imu(imu) == 0) {
+			write_sensor_err_event(EVENT_IMU, imu->id, 0);
+			check_imus_for_reset(imu);
+		}
+	}
+
+	for (size_t i = 0; i < NUM_IMUS; i++) {
+		imu_inst_t* imu = &imus[i];
+		if (!imu->check_reset) {
+			continue;
+		}
+		wait_for_ls_tick();
+		const int ret = check_imu_reset(imu);
+		if (ret) {
+			write_sensor_err_event(EVENT_IMU, imu->id, ret);
+		}
+	}
+}
+
 int main() {
 	stdio_init_all();
 
-	init_resistive_sensors();
+	// Load per-board calibration, used to build the resistive sensor
+	// conversion tables. The calibration file is built into the firmware
+	// for now.
+	//
+	// TODO: read the calibration file off of the SD card instead once the
+	// SD logger is wired up.
+	calibration_t cal;
+	if (load_calibration(&cal, board_calibration)) {
+		printf("ERR - bad calibration file, using defaults\r\n");
+	}
+	init_resistive_sensors(&cal);
+
+	// Configure the active thermistor controller.
+	//
+	// TODO: configure the setpoint and gains from the SD card settings or
+	// over the serial console or something.
+	therm_ctrl = (therm_ctrl_t){
+		.setpoint_mdeg_c = ACTIVE_THERM_SETPOINT_MDEG_C,
+		.kp = THERM_CTRL_DUTY_ONE / 4,
+		.ki = THERM_CTRL_DUTY_ONE / 20,
+		.max_duty = THERM_CTRL_DUTY_ONE - (int32_t)(
+			((int64_t)THERM_CTRL_DUTY_ONE * THERM_CTRL_GUARD_US) /
+			THERM_CTRL_PERIOD_US),
+		.rate_hz = THERM_CTRL_RATE_HZ,
+	};
+	init_therm_ctrl(&therm_ctrl);
 	init_ext_adc(&ext_adc);
+	for (int i = 0; i < EXT_ADC_NUM_CHANNELS; i++) {
+		init_decim_filter(&ext_adc_filters[i], EXT_ADC_DECIM_RATIO_LOG2);
+	}
+	ext_adc_decim_delay_us = ((int64_t)decim_filter_delay_x2(&ext_adc_filters[0]) *
+		EXT_ADC_NUM_CHANNELS * 1000000) / (2 * EXT_ADC_SPS);
 
-	// Configure IMU 0 device specific settings and initialize it.
-	imu0 = (imu_inst_t){
-		.i2c = i2c1,
-		.bus_addr = IMU_ADDR,
-		.id = 0,
+	// Free-run SysTick from the system clock so we can count cycles in the
+	// sampling interrupts.
+	systick_hw->rvr = 0x00ffffff;
+	systick_hw->cvr = 0;
+	systick_hw->csr = 0x5;
+
+	// Initialize all the IMUs in the table, the ones that don't respond
+	// are skipped when sampling until a background probe finds them.
+	imu_bus_stats = (imu_bus_stats_t){
+		.budget_us = 1000000/TIMER_RATE_HZ,
 	};
-	init_imu(&imu0, IMU_SCL, IMU_SDA);
+	for (size_t i = 0; i < NUM_IMUS; i++) {
+		if (init_imu(&imus[i])) {
+			printf("IMU %d not connected\r\n", imus[i].id);
+		}
+	}
 
 	init_event_bus(&event_bus);
 	
-	// Set up the timers to fire at 500Hz and 2KHz. Negative timeout means
-	// that the delay should be the delay between callbacks starting, if it
-	// was posititve then it would delay between the end of one callback
-	// and the start of the next. This seems insane, I do not know why
-	// delay between callback starts is not the default.
+	// Start acquiring from the ext ADC on its DRDY edges. The gpio
+	// interrupt gets the highest priority so it can preempt the timer
+	// callbacks - a ~300us conversion period is shorter than a low speed
+	// tick spent reading IMUs. Writes to the event bus are still safe since
+	// the queues disable interrupts while they hold their spinlocks.
+	irq_set_priority(IO_IRQ_BANK0, PICO_HIGHEST_IRQ_PRIORITY);
+	init_isr_timing(&ext_adc_isr_timing, ISR_EXT_ADC, EXT_ADC_ISR_BUDGET_US,
+			0, EXT_ADC_SPS);
+	gpio_set_irq_enabled_with_callback(EXT_ADC_PIN_DRDY, GPIO_IRQ_EDGE_FALL,
+			true, &ext_adc_drdy_callback);
+
+	// Set up the timers to fire at 500Hz, plus the thermistor controller
+	// at its own rate. Negative timeout means that the delay
+	// should be the delay between callbacks starting, if it was posititve
+	// then it would delay between the end of one callback and the start of
+	// the next. This seems insane, I do not know why delay between callback
+	// starts is not the default.
 	repeating_timer_t timer1;
 	repeating_timer_t timer2;
-	if(!add_repeating_timer_us(-1000000/500, ls_timer_callback, NULL, &timer1)){
+	init_isr_timing(&ls_isr_timing, ISR_LS_TIMER, LS_ISR_BUDGET_US,
+			1000000/TIMER_RATE_HZ, TIMER_RATE_HZ);
+	if(!add_repeating_timer_us(-1000000/TIMER_RATE_HZ, ls_timer_callback,
+			NULL, &timer1)){
 		printf("failed to add timer\n");
 		return 1;
 	}
-	if(!add_repeating_timer_us(-1000000/2000, hs_timer_callback, NULL, &timer2)){
+	init_isr_timing(&therm_ctrl_isr_timing, ISR_THERM_CTRL,
+			THERM_CTRL_ISR_BUDGET_US, THERM_CTRL_PERIOD_US,
+			THERM_CTRL_RATE_HZ);
+	if(!add_repeating_timer_us(-THERM_CTRL_PERIOD_US,
+			therm_ctrl_timer_callback, NULL, &timer2)){
 		printf("failed to add timer\n");
 		return 1;
 	}
@@ -155,8 +705,13 @@ int main() {
 	// Launch event loop on second core
 	multicore_launch_core1(event_loop);
 
+	// Core 0 is otherwise idle outside of the sampling interrupts, so it
+	// handles the slow recovery of stuck IMU buses and faulted or absent
+	// IMUs in the background.
 	while (true) {
-		tight_loop_contents();
+		sleep_us(IMU_RECOVERY_INTERVAL_US);
+		recover_stuck_imu_buses();
+		retry_faulted_imus();
 	}
 }
 
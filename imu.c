@@ -1,3 +1,5 @@
+#include "pico/stdlib.h"
+
 #include "hardware/gpio.h"
 
 #include "imu.h"
@@ -7,33 +9,113 @@
 #define MPU6050_GYRO_CONFIG	0x1B
 #define MPU6050_ACCEL_CONFIG	0x1C
 #define MPU6050_ACCEL_XOUT_H	0x3B
-#define MPU6050_GYRO_XOUT_H	0x43
 #define MPU6050_PWR_MGMT_1	0x6B
 
+// PWR_MGMT_1 sleep bit, set when the MPU-6050 comes out of reset. We always
+// clear it when configuring.
+#define MPU6050_PWR_MGMT_1_SLEEP	0x40
+
+// The WHO_AM_I register always reads back the upper 6 bits of the default
+// address, regardless of the AD0 pin.
+#define MPU6050_WHO_AM_I_VAL	0x68
+
+// Number of data bytes in one burst read, the accel, temp and gyro registers
+// are contiguous starting from ACCEL_XOUT_H: AXH, AXL, AYH, AYL, AZH, AZL, TH,
+// TL, GXH, GXL, GYH, GYL, GZH, GZL.
+#define MPU6050_BURST_LEN	14
+
+// Half period of the bit-banged SCL clock used to clear a stuck bus, ~100kHz.
+#define IMU_BUS_CLEAR_HALF_PERIOD_US 5
+
+// SDA has to read low this many times, IMU_BUS_CLEAR_HALF_PERIOD_US apart, for
+// the bus to count as stuck.
+#define IMU_BUS_STUCK_SAMPLES 4
+
+// Set while the background owns a bus for a recovery or a re-probe, the
+// sampling interrupt must leave it alone until it is done.
+static volatile bool bus_claimed[NUM_I2CS];
+
 // Helper function to do a single simple register write.
-static inline void imu_reg_write(imu_inst_t* imu, const uint8_t reg, const uint8_t val) {
+static inline int imu_reg_write(imu_inst_t* imu, const uint8_t reg,
+		const uint8_t val) {
 	uint8_t bytes[2] = {reg, val};
-	i2c_write_blocking(imu->i2c, imu->bus_addr, bytes, 2, false);
+	return i2c_write_timeout_us(imu->i2c, imu->bus_addr, bytes, 2, false,
+			IMU_I2C_TIMEOUT_US(2));
+}
+
+// Helper function to read a contiguous block of registers.
+static inline int imu_reg_read(imu_inst_t* imu, const uint8_t reg,
+		uint8_t* bytes, size_t len) {
+	int ret = i2c_write_timeout_us(imu->i2c, imu->bus_addr, &reg, 1, true,
+			IMU_I2C_TIMEOUT_US(1));
+	if (ret < 0) {
+		return ret;
+	}
+	return i2c_read_timeout_us(imu->i2c, imu->bus_addr, bytes, len, false,
+			IMU_I2C_TIMEOUT_US(len));
 }
 
-void init_imu(imu_inst_t* imu, int scl_pin, int sda_pin) {
+// Initializes the I2C peripheral and pinmux for the IMU's bus.
+static void imu_bus_init(imu_inst_t* imu) {
 	// Initialize I2C port at 400kHz
 	i2c_init(imu->i2c, 400*1000);
 
 	// Initialize I2C pins
-	gpio_set_function(sda_pin, GPIO_FUNC_I2C);
-	gpio_set_function(scl_pin, GPIO_FUNC_I2C);
+	gpio_set_function(imu->sda_pin, GPIO_FUNC_I2C);
+	gpio_set_function(imu->scl_pin, GPIO_FUNC_I2C);
+}
+
+// Clears a stuck bus. If a transaction was cut off by a glitchy connection, a
+// slave can be left holding SDA low waiting for clocks that will never come,
+// so we take the pins away from the I2C peripheral and clock SCL by hand
+// until SDA is released (9 clocks is always enough to finish a byte and the
+// ack), then send a STOP. Pins are driven open-drain style, by switching
+// between driving low and input.
+static void imu_bus_clear(int scl_pin, int sda_pin) {
+	gpio_init(scl_pin);
+	gpio_init(sda_pin);
+	gpio_put(scl_pin, 0);
+	gpio_put(sda_pin, 0);
+
+	for (int i = 0; i < 9 && !gpio_get(sda_pin); i++) {
+		gpio_set_dir(scl_pin, GPIO_OUT);
+		busy_wait_us_32(IMU_BUS_CLEAR_HALF_PERIOD_US);
+		gpio_set_dir(scl_pin, GPIO_IN);
+		busy_wait_us_32(IMU_BUS_CLEAR_HALF_PERIOD_US);
+	}
+
+	// STOP is SDA rising while SCL is high.
+	gpio_set_dir(scl_pin, GPIO_OUT);
+	gpio_set_dir(sda_pin, GPIO_OUT);
+	busy_wait_us_32(IMU_BUS_CLEAR_HALF_PERIOD_US);
+	gpio_set_dir(scl_pin, GPIO_IN);
+	busy_wait_us_32(IMU_BUS_CLEAR_HALF_PERIOD_US);
+	gpio_set_dir(sda_pin, GPIO_IN);
+	busy_wait_us_32(IMU_BUS_CLEAR_HALF_PERIOD_US);
+}
+
+// Probes and configures the IMU, assuming its bus is already initialized.
+//
+// Returns 0 on success, non-zero if the IMU did not respond.
+static int imu_configure(imu_inst_t* imu) {
+	// Check that there's actually an MPU-6050 at this address, the IMUs
+	// attached through the connector are optional.
+	uint8_t who_am_i = 0;
+	if (imu_reg_read(imu, MPU6050_WHO_AM_I, &who_am_i, 1) < 0 ||
+			(who_am_i & 0x7e) != MPU6050_WHO_AM_I_VAL) {
+		return 1;
+	}
 
 	// Set IMU registers
 	//
 	// TODO: consider if we should use a different clock source than the
 	// default 8MHz internal oscillator.
-	//
-	// TODO: read whoami register and enable/disable the IMU.
 
 	// We must write to the pwr mgmt 1 register to wake up the chip, just
 	// write all 0's the default value.
-	imu_reg_write(imu, MPU6050_PWR_MGMT_1, 0x00);
+	if (imu_reg_write(imu, MPU6050_PWR_MGMT_1, 0x00) < 0) {
+		return 1;
+	}
 
 	// Set to full +/-16g range
 	// 
@@ -49,7 +131,9 @@ void init_imu(imu_inst_t* imu, int scl_pin, int sda_pin) {
 		2048.0f,
 	};
 	const uint8_t accel_config = (accel_fsr << 3);
-	imu_reg_write(imu, MPU6050_ACCEL_CONFIG, accel_config);
+	if (imu_reg_write(imu, MPU6050_ACCEL_CONFIG, accel_config) < 0) {
+		return 1;
+	}
 	imu->accel_scale = 1.0f/lsb_per_g[accel_fsr];
 
 	// Set gyro 2000dps
@@ -66,35 +150,161 @@ void init_imu(imu_inst_t* imu, int scl_pin, int sda_pin) {
 		16.4f,
 	};
 	const uint8_t gyro_config = (gyro_fsr << 3);
-	imu_reg_write(imu, MPU6050_GYRO_CONFIG, gyro_config);
+	if (imu_reg_write(imu, MPU6050_GYRO_CONFIG, gyro_config) < 0) {
+		return 1;
+	}
 	imu->gyro_scale = 1.0f/lsb_per_deg_s[gyro_fsr];
+
+	return 0;
 }
 
-int read_imu(imu_inst_t* imu, imu_sample_t* sample) {
-	uint8_t reg_addr = 0;
-	uint8_t bytes[6] = {0};
+int init_imu(imu_inst_t* imu) {
+	imu_bus_init(imu);
 
-	// Read accel data from 6 data registers, high and low bytes separated,
-	// in the following order: XH, XL, YH, YL, ZH, ZL
-	reg_addr = MPU6050_ACCEL_XOUT_H;
-	i2c_write_blocking(imu->i2c, imu->bus_addr, &reg_addr, 1, true);
-	i2c_read_blocking(imu->i2c, imu->bus_addr, bytes, 6, false);
+	if (imu_configure(imu)) {
+		imu->state = IMU_ABSENT;
+		imu->retry_interval_us = IMU_RETRY_MAX_US;
+		imu->next_retry_us = time_us_32() + IMU_RETRY_MAX_US;
+		return 1;
+	}
+	imu->state = IMU_OK;
+	return 0;
+}
 
-	// Reconstruct samples from individual bytes
+// Marks the IMU faulted, with its first retry after the minimum backoff.
+static inline void imu_set_fault(imu_inst_t* imu) {
+	imu->state = IMU_FAULT;
+	imu->retry_interval_us = IMU_RETRY_MIN_US;
+	imu->next_retry_us = time_us_32() + IMU_RETRY_MIN_US;
+}
+
+bool __time_critical_func(imu_ready)(const imu_inst_t* imu) {
+	return imu->state == IMU_OK && !bus_claimed[i2c_hw_index(imu->i2c)];
+}
+
+int recover_imu_bus(i2c_inst_t* i2c, imu_inst_t* imus, size_t num_imus) {
+	// Find the pins for this bus from any IMU on it.
+	imu_inst_t* bus_imu = NULL;
+	for (size_t i = 0; i < num_imus; i++) {
+		if (imus[i].i2c == i2c) {
+			bus_imu = &imus[i];
+			break;
+		}
+	}
+	if (bus_imu == NULL) {
+		return 1;
+	}
+
+	// We run on the same core as the sampling interrupt, so once the flag
+	// is set the interrupt can never be in the middle of a transaction on
+	// this bus.
+	bus_claimed[i2c_hw_index(i2c)] = true;
+
+	i2c_deinit(i2c);
+	imu_bus_clear(bus_imu->scl_pin, bus_imu->sda_pin);
+	imu_bus_init(bus_imu);
+
+	// Re-initialize everything on the bus, not just the faulted IMUs - if
+	// the connector glitched, the others may have browned out and reset
+	// their config too.
+	int ret = 0;
+	for (size_t i = 0; i < num_imus; i++) {
+		imu_inst_t* imu = &imus[i];
+		if (imu->i2c != i2c || imu->state == IMU_ABSENT) {
+			continue;
+		}
+		if (imu_configure(imu)) {
+			imu_set_fault(imu);
+			ret = 1;
+		} else {
+			imu->state = IMU_OK;
+		}
+	}
+
+	bus_claimed[i2c_hw_index(i2c)] = false;
+	return ret;
+}
+
+bool imu_retry_due(const imu_inst_t* imu) {
+	return imu->state != IMU_OK &&
+		(int32_t)(time_us_32() - imu->next_retry_us) >= 0;
+}
+
+int retry_imu(imu_inst_t* imu) {
+	// Same as recover_imu_bus(), we share a core with the sampling
+	// interrupt, so it can't be mid transaction once the bus is claimed.
+	bus_claimed[i2c_hw_index(imu->i2c)] = true;
+	const bool ok = imu_configure(imu) == 0;
+	if (ok) {
+		imu->state = IMU_OK;
+	}
+	bus_claimed[i2c_hw_index(imu->i2c)] = false;
+	if (ok) {
+		return 0;
+	}
+
+	imu->retry_interval_us *= 2;
+	if (imu->retry_interval_us > IMU_RETRY_MAX_US) {
+		imu->retry_interval_us = IMU_RETRY_MAX_US;
+	}
+	imu->next_retry_us = time_us_32() + imu->retry_interval_us;
+	return 1;
+}
+
+int check_imu_reset(imu_inst_t* imu) {
+	imu->check_reset = false;
+	if (imu->state != IMU_OK) {
+		return 0;
+	}
+
+	uint8_t pwr_mgmt_1 = 0;
+	bus_claimed[i2c_hw_index(imu->i2c)] = true;
+	const int ret = imu_reg_read(imu, MPU6050_PWR_MGMT_1, &pwr_mgmt_1, 1);
+	bus_claimed[i2c_hw_index(imu->i2c)] = false;
+	if (ret < 0) {
+		imu_set_fault(imu);
+		return ret;
+	}
+	if (pwr_mgmt_1 & MPU6050_PWR_MGMT_1_SLEEP) {
+		imu_set_fault(imu);
+		return PICO_ERROR_IO;
+	}
+	return 0;
+}
+
+bool imu_bus_stuck(const imu_inst_t* imu) {
+	for (int i = 0; i < IMU_BUS_STUCK_SAMPLES; i++) {
+		if (gpio_get(imu->sda_pin)) {
+			return false;
+		}
+		busy_wait_us_32(IMU_BUS_CLEAR_HALF_PERIOD_US);
+	}
+	return true;
+}
+
+int __time_critical_func(read_imu)(imu_inst_t* imu, imu_sample_t* sample) {
+	uint8_t bytes[MPU6050_BURST_LEN] = {0};
+
+	// Read accel, temp and gyro data in one burst, high and low bytes
+	// separated. One transaction instead of one per sensor saves an
+	// address phase and a repeated start per read, which adds up with
+	// several IMUs sharing the bus.
+	const int ret = imu_reg_read(imu, MPU6050_ACCEL_XOUT_H, bytes,
+			MPU6050_BURST_LEN);
+	if (ret < 0) {
+		imu_set_fault(imu);
+		return ret;
+	}
+
+	// Reconstruct samples from individual bytes, skipping over the temp
+	// registers.
+	sample->id = imu->id;
 	sample->accel.x = imu->accel_scale * (int16_t)((bytes[0]<< 8) | bytes[1]);
 	sample->accel.y = imu->accel_scale * (int16_t)((bytes[2]<< 8) | bytes[3]);
 	sample->accel.z = imu->accel_scale * (int16_t)((bytes[4]<< 8) | bytes[5]);
-
-	// Read gyro data from 6 data registers, high and low bytes separated,
-	// in the following order: XH, XL, YH, YL, ZH, ZL
-	reg_addr = MPU6050_GYRO_XOUT_H;
-	i2c_write_blocking(imu->i2c, imu->bus_addr, &reg_addr, 1, true);
-	i2c_read_blocking(imu->i2c, imu->bus_addr, bytes, 6, false);
-
-	// Reconstruct samples from individual bytes
-	sample->gyro.x = imu->gyro_scale * (int16_t)((bytes[0]<< 8) | bytes[1]);
-	sample->gyro.y = imu->gyro_scale * (int16_t)((bytes[2]<< 8) | bytes[3]);
-	sample->gyro.z = imu->gyro_scale * (int16_t)((bytes[4]<< 8) | bytes[5]);
+	sample->gyro.x = imu->gyro_scale * (int16_t)((bytes[8]<< 8) | bytes[9]);
+	sample->gyro.y = imu->gyro_scale * (int16_t)((bytes[10]<< 8) | bytes[11]);
+	sample->gyro.z = imu->gyro_scale * (int16_t)((bytes[12]<< 8) | bytes[13]);
 
 	return 0;
 }
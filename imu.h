@@ -3,6 +3,40 @@
 
 #include "hardware/i2c.h"
 
+// Each I2C transaction in the sampling path gets a hard timeout, a bit over
+// the nominal transfer time at 400kHz (9 bits per byte plus the address
+// byte), so a loose connector can never hang the sampling interrupt.
+#define IMU_I2C_BYTE_US 23
+#define IMU_I2C_TIMEOUT_US(len) ((3*((len) + 1)*IMU_I2C_BYTE_US)/2 + 20)
+
+// Worst case time one read_imu() call can spend on the bus before giving up,
+// one register address write plus one 14 byte burst read.
+#define IMU_READ_BUDGET_US (IMU_I2C_TIMEOUT_US(1) + IMU_I2C_TIMEOUT_US(14))
+
+// Worst case time one retry_imu() or check_imu_reset() call can spend on the
+// bus, a WHO_AM_I probe plus the 3 config register writes. These run in the
+// background between two sampling ticks, so this has to fit in the gap.
+#define IMU_RETRY_BUDGET_US (IMU_I2C_TIMEOUT_US(1) + IMU_I2C_TIMEOUT_US(1) + \
+		3*IMU_I2C_TIMEOUT_US(2))
+
+// A faulted IMU is retried after IMU_RETRY_MIN_US, doubling the wait after
+// every failed retry up to IMU_RETRY_MAX_US, so an unplugged IMU costs next to
+// nothing. An IMU that was missing at startup is probed every
+// IMU_RETRY_MAX_US, in case its connector gets seated later.
+#define IMU_RETRY_MIN_US 100000
+#define IMU_RETRY_MAX_US 3200000
+
+// Connection state of an IMU. IMUs are only sampled when IMU_OK. When a
+// transaction fails in the sampling path the IMU is marked IMU_FAULT and
+// skipped, and retry_imu() periodically tries to bring it back from the
+// background. If the whole bus is stuck, recover_imu_bus() clears it first.
+typedef enum imu_state {
+	// Hasn't responded since startup, retry_imu() keeps probing for it.
+	IMU_ABSENT = 0,
+	IMU_OK = 1,
+	IMU_FAULT = 2,
+} imu_state_t;
+
 // The IMU is an MPU-6050 6DOF accel/gyro with quite a few features. We use
 // relatively few of those features, so our configuration and data reading
 // routines are relatively simple.
@@ -16,15 +50,31 @@ typedef struct imu_inst {
 	// The address of this device on the I2C bus
 	uint8_t bus_addr;
 
+	// Pins the I2C peripheral is muxed onto. IMUs sharing a bus share pins.
+	int scl_pin;
+	int sda_pin;
+
 	// Scale factors for acceleration and gyro, can be the default or come
 	// from a calibration routine.
 	float accel_scale;
 	float gyro_scale;
 
-	// ID of the IMU. Since we have potentially 2 IMUs connected, this will
-	// be either 0 or 1 depending on which IMU it came from. IMU 0 is
-	// mounted to the PCB, IMU 1 is attached through the connector.
+	// ID of the IMU, used to tag its samples so each IMU gets its own
+	// stream on the host. IMU 0 is mounted to the PCB, the rest are
+	// attached through the connector.
 	int id;
+
+	// Set by init_imu() and read_imu(), see imu_state_t. Written from the
+	// sampling interrupt and the background recovery, hence volatile.
+	volatile imu_state_t state;
+
+	// Retry backoff while IMU_FAULT or IMU_ABSENT, see imu_retry_due().
+	uint32_t retry_interval_us;
+	uint32_t next_retry_us;
+
+	// Set when another IMU on the bus came back from a fault, so this one
+	// may have been reset by the same glitch, see check_imu_reset().
+	bool check_reset;
 } imu_inst_t;
 
 // Simple 3 element float vector with array or component-level access to
@@ -50,18 +100,83 @@ typedef struct imu_sample {
 	vec3f_t gyro;
 } imu_sample_t;
 
+// Per-tick I2C bus occupancy of the IMU reads, averaged over a reporting
+// interval. Comparing the time spent on the bus against the tick period tells
+// us how many IMUs fit at a given sample rate.
+typedef struct imu_bus_stats {
+	// Number of working IMUs read each tick, as of the report.
+	int num_imus;
+
+	// Mean and worst case time spent reading all IMUs in one tick.
+	uint32_t mean_us;
+	uint32_t max_us;
+
+	// Tick period the reads have to fit in.
+	uint32_t budget_us;
+} imu_bus_stats_t;
+
 // Initializes IMU given the instance data.
 //
 // NOTE: Instance struct must be filled out with correct instance-specific
 // data, a config struct felt like overkill here so we just fill out the
 // structs before calling into the common initialization logic in this
 // function.
-void init_imu(imu_inst_t* imu, int scl_pin, int sda_pin);
+//
+// Returns 0 on success, non-zero if the IMU did not respond, in which case it
+// is marked IMU_ABSENT.
+int init_imu(imu_inst_t* imu);
+
+// Returns true if the IMU should be sampled - it is working, and its bus is
+// not currently claimed by the background for a recovery or a re-probe.
+bool imu_ready(const imu_inst_t* imu);
 
-// Reads out all accel/gyro data registers and stores the converted results
-// into the sample struct.
+// Reads out all accel/gyro data registers in a single burst transaction and
+// stores the converted results into the sample struct. Never spends more than
+// IMU_READ_BUDGET_US on the bus.
 //
-// Returns 0 on success, non-zero on failure.
+// Returns 0 on success, or the negative pico error code (PICO_ERROR_TIMEOUT or
+// PICO_ERROR_GENERIC for a NACK) on failure, in which case the IMU is marked
+// IMU_FAULT.
 int read_imu(imu_inst_t* imu, imu_sample_t* sample);
 
+// Returns true if the IMU is faulted or absent and due for another
+// retry_imu().
+bool imu_retry_due(const imu_inst_t* imu);
+
+// Tries to bring a faulted or absent IMU back by probing and re-configuring
+// it. Claims the bus while it does, so the sampling interrupt skips the other
+// IMUs on the bus if it fires in the meantime. Never spends more than
+// IMU_RETRY_BUDGET_US on the bus, so call it from the background right after a
+// sampling tick and it is done before the next. On failure the next retry is
+// backed off.
+//
+// Returns 0 if the IMU is back to IMU_OK, non-zero otherwise.
+int retry_imu(imu_inst_t* imu);
+
+// Checks whether a working IMU has been reset (it wakes up asleep, with its
+// default config), e.g. by a connector glitch that took down another IMU on the
+// same bus. Clears imu->check_reset. Claims the bus and never spends more than
+// IMU_RETRY_BUDGET_US on it, like retry_imu().
+//
+// Returns 0 if the IMU is still configured (or not working anyway), or a
+// negative pico error code if it was reset (PICO_ERROR_IO) or didn't respond,
+// in which case it is marked IMU_FAULT so it gets re-configured by
+// retry_imu().
+int check_imu_reset(imu_inst_t* imu);
+
+// Returns true if the IMU's bus is stuck, with SDA held low by a slave left in
+// the middle of a cut off transaction. Only meaningful outside of the sampling
+// interrupt, when no transaction is in progress.
+bool imu_bus_stuck(const imu_inst_t* imu);
+
+// Clears the given I2C bus by clocking out any stuck transaction, then
+// re-initializes every non-absent IMU in the table attached to it. While this
+// runs imu_ready() is false for all IMUs on the bus, so the sampling interrupt
+// leaves the bus alone. This is slow (milliseconds), so call it from the
+// background, never from an interrupt, and only once imu_bus_stuck() - with
+// SDA held low, none of the IMUs on the bus are working anyway.
+//
+// Returns 0 if all IMUs on the bus came back, non-zero otherwise.
+int recover_imu_bus(i2c_inst_t* i2c, imu_inst_t* imus, size_t num_imus);
+
 #endif // _IMU_H
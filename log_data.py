@@ -1,5 +1,5 @@
+import argparse
 import collections
-import matplotlib.pyplot as plt
 import numpy as np
 import re
 import serial
@@ -7,34 +7,48 @@ import time
 import multiprocessing
 import queue
 
+# Number of IMUs the firmware may report, each one gets its own set of streams.
+NUM_IMUS = 2
+IMU_AXES = ['ACCEL X', 'ACCEL Y', 'ACCEL Z', 'GYRO X', 'GYRO Y', 'GYRO Z']
+
+# Names of the firmware's sampling interrupts, by the isr id in ISR stats
+# events.
+ISR_NAMES = {0: 'ext ADC', 1: 'low speed timer', 2: 'therm ctrl'}
+
 # Hardcoded list of metric names
 METRIC_NAMES = [
     'EXT ADC 0',
     'EXT ADC 1',
     'EXT ADC 2',
     'EXT ADC 3',
-    'ACCEL X',
-    'ACCEL Y',
-    'ACCEL Z',
-    'GYRO X',
-    'GYRO Y',
-    'GYRO Z',
+    *[f'IMU {i} {axis}' for i in range(NUM_IMUS) for axis in IMU_AXES],
     'ACTIVE THERM',
     'PASSIVE THERM',
     'FSR',
+    'ACTIVE THERM C',
+    'PASSIVE THERM C',
+    'FSR N',
+    'THERM CTRL ERROR',
+    'THERM CTRL DUTY',
 ]
 
 # Simple wrapper around collections.deque to maintain a sliding window of the
 # last `size` samples (a time and value tuple) and plot these samples onto a
 # matplotlib axis.
+#
+# If given a sink (like a recording.py column), every sample is also written to
+# the sink.
 class MetricStream:
-    def __init__(self, name, size):
+    def __init__(self, name, size, sink=None):
         self.name = name
         self.size = size
         self.buffer = collections.deque(maxlen=size)
+        self.sink = sink
 
     def write(self, timestamp, value):
         self.buffer.append((timestamp, value))
+        if self.sink is not None:
+            self.sink.write(timestamp, value)
 
     def plot(self, ax):
         a = np.array(self.buffer)
@@ -73,38 +87,96 @@ def decode_event_str(metrics, event_str):
         channel = int(fields[0])
         metric_name = f'EXT ADC {channel}'
         metrics[metric_name].write(timestamp_s, int(fields[1]))
+    elif event_type == 7:
+        if len(fields) != 2:
+            return
+
+        # Decimated EXT_ADC event, sent instead of the raw ones when the
+        # firmware filters the ext ADC, log to the same channel stream.
+        channel = int(fields[0])
+        metric_name = f'EXT ADC {channel}'
+        metrics[metric_name].write(timestamp_s, float(fields[1]))
     elif event_type == 1:
-        # IMU event, log to all IMU data streams
+        # IMU event, log to all of this IMU's data streams
         #
-        # All fields are floats, preconvert to floats and unpack into
-        # components.
-        if len(fields) != 6:
+        # The first field is the IMU id, the rest are floats, preconvert to
+        # floats and log each component to its stream.
+        if len(fields) != 7:
             return
 
-        fields = map(float, fields)
-        ax, ay, az, gx, gy, gz = fields
+        imu_id = int(fields[0])
+        if imu_id >= NUM_IMUS:
+            return
 
-        # Manually log to all streams, there's definitely a cleaner way to do
-        # this but this is easily understandable and simple.
-        metrics['ACCEL X'].write(timestamp_s, ax)
-        metrics['ACCEL Y'].write(timestamp_s, ay)
-        metrics['ACCEL Z'].write(timestamp_s, az)
-        metrics['GYRO X'].write(timestamp_s, gx)
-        metrics['GYRO Y'].write(timestamp_s, gy)
-        metrics['GYRO Z'].write(timestamp_s, gz)
+        for axis, value in zip(IMU_AXES, map(float, fields[1:])):
+            metrics[f'IMU {imu_id} {axis}'].write(timestamp_s, value)
     elif event_type == 2:
-        if len(fields) != 3:
+        if len(fields) != 6:
             return
 
-        # Resistive sensors event, same as above, unpack floats fields.
+        # Resistive sensors event, same as above, unpack floats fields. The
+        # first 3 are raw volts, the last 3 are calibrated deg C and Newtons.
+        # The active thermistor values lag the timestamp by up to one
+        # control period, see EVENT_RES in event.h.
         fields = map(float, fields)
-        at, pt, fsr = fields
+        at, pt, fsr, at_c, pt_c, fsr_n = fields
 
         # Manually log to all streams, there's definitely a cleaner way to do
         # this but this is easily understandable and simple.
         metrics['ACTIVE THERM'].write(timestamp_s, at)
         metrics['PASSIVE THERM'].write(timestamp_s, pt)
         metrics['FSR'].write(timestamp_s, fsr)
+        metrics['ACTIVE THERM C'].write(timestamp_s, at_c)
+        metrics['PASSIVE THERM C'].write(timestamp_s, pt_c)
+        metrics['FSR N'].write(timestamp_s, fsr_n)
+    elif event_type == 4:
+        if len(fields) != 4:
+            return
+
+        # Active thermistor controller telemetry. The measured temperature
+        # is already logged by the resistive sensor events, so just log the
+        # loop error and heater duty cycle.
+        fields = map(float, fields)
+        _, _, err, duty = fields
+        metrics['THERM CTRL ERROR'].write(timestamp_s, err)
+        metrics['THERM CTRL DUTY'].write(timestamp_s, duty)
+    elif event_type == 5:
+        if len(fields) != 4:
+            return
+
+        # IMU bus occupancy stats, these come once a second so just print
+        # them rather than plotting.
+        num_imus, mean_us, max_us, budget_us = map(int, fields)
+        print(f'IMU bus: {num_imus} IMUs, mean {mean_us}us, max {max_us}us '
+              f'of {budget_us}us per tick')
+    elif event_type == 8:
+        if len(fields) != 3:
+            return
+
+        # Ext ADC decimation filter cycle budget, comes once a second.
+        mean_cycles, max_cycles, budget_cycles = map(int, fields)
+        print(f'Decimation: mean {mean_cycles}, max {max_cycles} cycles per '
+              f'sample of {budget_cycles} per tick')
+    elif event_type == 9:
+        if len(fields) != 5:
+            return
+
+        # Sampling interrupt timing, one per interrupt once a second.
+        isr, max_latency_us, mean_us, max_us, budget_us = map(int, fields)
+        latency = f'{max_latency_us}us' if max_latency_us >= 0 else 'n/a'
+        over = ' OVER BUDGET' if max_us > budget_us else ''
+        print(f'ISR {ISR_NAMES.get(isr, isr)}: max latency {latency}, mean '
+              f'{mean_us}us, max {max_us}us of {budget_us}us{over}')
+    elif event_type == 6:
+        if len(fields) != 3:
+            return
+
+        # Sensor fault or recovery, source is the event type of the sensor.
+        source, sensor_id, code = map(int, fields)
+        if code == 0:
+            print(f'Sensor {source}:{sensor_id} recovered')
+        else:
+            print(f'Sensor {source}:{sensor_id} faulted with error {code}')
 
 # Creates a dict of metrics that map from the given name to a MetricStream of
 # the same name. This dict is a nice way to access a collection of name metric
@@ -113,11 +185,15 @@ def decode_event_str(metrics, event_str):
 # Also returns a mapping of metric names to indexes used for plotting - since
 # dict iteration order is not guaranteed, this helps maintain stable plotting
 # order.
-def init_metrics(names, size):
+#
+# The sinks dict optionally maps metric names to sinks that also receive every
+# sample.
+def init_metrics(names, size, sinks=None):
+    sinks = sinks or {}
     metrics = {}
     metric_idxs = {}
     for idx, name in enumerate(names):
-        metrics[name] = MetricStream(name, size)
+        metrics[name] = MetricStream(name, size, sinks.get(name))
         metric_idxs[name] = idx
     return metrics, metric_idxs
 
@@ -164,42 +240,61 @@ def drain_queue(q):
     return items
 
 
-# Get port from args
-#
-# TODO: argparse is way nicer
-import sys
-port = sys.argv[1]
-
-# Connect to serial port and discard the first line, which may contain partial
-# data and is maybe invalid.
-# Initialize metric streams
-metrics, metric_idxs = init_metrics(METRIC_NAMES, 2*500)
-num_metrics = len(metrics)
-
-# Create plots for live plotting
-fig, axs = plt.subplots(num_metrics,1)
-plt.show(block=False)
-
-# Create a message queue and start the background serial reader process
-event_q = multiprocessing.Queue()
-p = multiprocessing.Process(target=lambda: serial_process(port, event_q), daemon=True)
-p.start()
-
-# Now drain the queue and draw as fast as possible
-while True:
-    try:
-        items = drain_queue(event_q)
-        if len(items) == 0:
-            time.sleep(0.001)
-            continue
-
-        print(f'Read {len(items)} from queue!')
-        for msg in items:
-            decode_event_str(metrics, msg)
-        for name, stream in metrics.items():
-            stream.plot(axs[metric_idxs[name]])
-        fig.canvas.draw()
-        fig.canvas.flush_events()
-
-    except KeyboardInterrupt:
-        break
+def main():
+    # Imported here so that other tools can reuse the decoder without the
+    # plotting dependencies.
+    import matplotlib.pyplot as plt
+    import recording
+
+    parser = argparse.ArgumentParser(
+        description='Plot the event stream from a board in real-ish time.')
+    parser.add_argument('port', help='serial port the board is connected to')
+    parser.add_argument('--record',
+                        help='also write every sample to a columnar '
+                             'recording in this directory')
+    args = parser.parse_args()
+
+    # Initialize metric streams, optionally recording them too.
+    writer = None
+    sinks = {}
+    if args.record:
+        writer = recording.RecordingWriter(args.record)
+        sinks = recording.metric_sinks(writer, METRIC_NAMES)
+    metrics, metric_idxs = init_metrics(METRIC_NAMES, 2*500, sinks)
+    num_metrics = len(metrics)
+
+    # Create plots for live plotting
+    fig, axs = plt.subplots(num_metrics,1)
+    plt.show(block=False)
+
+    # Create a message queue and start the background serial reader process
+    event_q = multiprocessing.Queue()
+    p = multiprocessing.Process(target=serial_process, args=(args.port, event_q), daemon=True)
+    p.start()
+
+    # Now drain the queue and draw as fast as possible
+    while True:
+        try:
+            items = drain_queue(event_q)
+            if len(items) == 0:
+                time.sleep(0.001)
+                continue
+
+            print(f'Read {len(items)} from queue!')
+            for msg in items:
+                decode_event_str(metrics, msg)
+            for name, stream in metrics.items():
+                stream.plot(axs[metric_idxs[name]])
+            fig.canvas.draw()
+            fig.canvas.flush_events()
+
+        except KeyboardInterrupt:
+            break
+
+    # Flush whatever is left of the recording.
+    if writer is not None:
+        writer.close()
+
+
+if __name__ == '__main__':
+    main()
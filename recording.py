@@ -0,0 +1,358 @@
+import argparse
+import bisect
+import json
+import os
+import time
+
+import numpy as np
+
+# Columnar recording format for captured metric streams. Rather than storing
+# the raw interleaved event text, each metric (ext ADC channel, IMU axis,
+# resistive sensor, ...) is stored as its own contiguous typed column, split
+# into fixed size chunks so a recording can grow without rewriting anything.
+# Pulling one metric out of an hour long capture, or one time range out of one
+# metric, then only touches the pages of the files that hold it.
+#
+# A recording is a directory laid out like:
+#
+# <recording>/index.json          - metric names, dtypes and chunk list
+# <recording>/<metric>/000000.ts.npy  - int64 timestamps, us since boot
+# <recording>/<metric>/000000.val.npy - values, in the metric's dtype
+# <recording>/<metric>/000000.sum.npy - per block first timestamp, min, max
+#
+# All the column files are plain .npy files, so they can be memory mapped and
+# sliced with no copies, and are easy to poke at with numpy directly. The
+# summary file has one entry per BLOCK_LEN samples. Its timestamps are a sparse
+# index into the chunk - a seek only has to binary search the summary and then
+# one block of raw timestamps - and its min/max let a zoomed out plot of any
+# range be drawn without touching the raw data at all.
+#
+# index.json is rewritten (atomically, by rename) every time a chunk is
+# flushed, so a recording that was cut off is still readable up to the last
+# flushed chunk.
+
+# Samples per chunk file and per summary block.
+CHUNK_LEN = 1 << 16
+BLOCK_LEN = 256
+
+INDEX_FILE = 'index.json'
+
+SUMMARY_DTYPE = np.dtype([('t', np.int64), ('min', np.float64), ('max', np.float64)])
+
+
+# Turns a metric name into a directory name.
+def metric_dir(name):
+    return name.lower().replace(' ', '_')
+
+
+def chunk_path(root, name, chunk_idx, kind):
+    return os.path.join(root, metric_dir(name), f'{chunk_idx:06d}.{kind}.npy')
+
+
+# Buffers one metric's samples and flushes them as chunks.
+class ColumnWriter:
+    def __init__(self, writer, name, dtype):
+        self.writer = writer
+        self.name = name
+        self.dtype = np.dtype(dtype)
+        self.ts = []
+        self.vals = []
+        self.chunks = []
+        os.makedirs(os.path.join(writer.root, metric_dir(name)), exist_ok=True)
+
+    # Appends one sample, timestamp in us since boot.
+    def append(self, timestamp_us, value):
+        self.ts.append(timestamp_us)
+        self.vals.append(value)
+        if len(self.ts) >= CHUNK_LEN:
+            self.flush()
+
+    # Same as append(), taking the timestamp in seconds like the MetricStreams
+    # in log_data.py, so a column can be used as a MetricStream sink.
+    def write(self, timestamp_s, value):
+        self.append(round(timestamp_s*1000000), value)
+
+    def flush(self):
+        if not self.ts:
+            return
+
+        # Samples of one metric come from one device queue so they should
+        # already be in order, but sort within the chunk just in case, the
+        # reader relies on it.
+        ts = np.array(self.ts, dtype=np.int64)
+        vals = np.array(self.vals, dtype=self.dtype)
+        order = np.argsort(ts, kind='stable')
+        ts = ts[order]
+        vals = vals[order]
+        self.ts = []
+        self.vals = []
+
+        starts = np.arange(0, len(ts), BLOCK_LEN)
+        summary = np.empty(len(starts), dtype=SUMMARY_DTYPE)
+        summary['t'] = ts[starts]
+        summary['min'] = np.minimum.reduceat(vals, starts)
+        summary['max'] = np.maximum.reduceat(vals, starts)
+
+        idx = len(self.chunks)
+        root = self.writer.root
+        np.save(chunk_path(root, self.name, idx, 'ts'), ts)
+        np.save(chunk_path(root, self.name, idx, 'val'), vals)
+        np.save(chunk_path(root, self.name, idx, 'sum'), summary)
+        self.chunks.append({
+            'count': len(ts),
+            't0': int(ts[0]),
+            't1': int(ts[-1]),
+            'min': float(summary['min'].min()),
+            'max': float(summary['max'].max()),
+        })
+        self.writer.write_index()
+
+
+# Writes a recording, one ColumnWriter per metric.
+class RecordingWriter:
+    def __init__(self, root):
+        self.root = root
+        self.columns = {}
+        os.makedirs(root, exist_ok=True)
+
+    # Gets the writer for a metric, creating it on first use.
+    def column(self, name, dtype=np.float32):
+        if name not in self.columns:
+            self.columns[name] = ColumnWriter(self, name, dtype)
+        return self.columns[name]
+
+    def write_index(self):
+        index = {
+            'chunk_len': CHUNK_LEN,
+            'block_len': BLOCK_LEN,
+            'metrics': {
+                name: {
+                    'dir': metric_dir(name),
+                    'dtype': col.dtype.str,
+                    'chunks': col.chunks,
+                } for name, col in self.columns.items()
+            },
+        }
+        tmp = os.path.join(self.root, INDEX_FILE + '.tmp')
+        with open(tmp, 'w') as f:
+            json.dump(index, f)
+        os.replace(tmp, os.path.join(self.root, INDEX_FILE))
+
+    def close(self):
+        for col in self.columns.values():
+            col.flush()
+        self.write_index()
+
+
+# Read access to one metric of a recording. Chunk files are memory mapped
+# lazily, and all reads that fall within one chunk return views into the
+# mapping rather than copies.
+class Column:
+    def __init__(self, root, name, meta):
+        self.root = root
+        self.name = name
+        self.dtype = np.dtype(meta['dtype'])
+        self.chunks = meta['chunks']
+        self.chunk_t0 = [c['t0'] for c in self.chunks]
+        self.maps = {}
+
+    def __len__(self):
+        return sum(c['count'] for c in self.chunks)
+
+    def time_range(self):
+        if not self.chunks:
+            return None
+        return self.chunks[0]['t0'], self.chunks[-1]['t1']
+
+    def chunk(self, idx):
+        if idx not in self.maps:
+            self.maps[idx] = tuple(
+                np.load(chunk_path(self.root, self.name, idx, kind), mmap_mode='r')
+                for kind in ('ts', 'val', 'sum'))
+        return self.maps[idx]
+
+    # Finds the index of the first sample in the chunk at or after t, using
+    # the summary as a sparse index so only one block of raw timestamps is
+    # searched.
+    def seek_in_chunk(self, idx, t):
+        ts, _, summary = self.chunk(idx)
+        block = max(int(np.searchsorted(summary['t'], t)) - 1, 0)
+        start = block*BLOCK_LEN
+        end = min(start + BLOCK_LEN, len(ts))
+        return start + int(np.searchsorted(ts[start:end], t))
+
+    # Finds the first chunk that can hold samples at or after t. A run of
+    # samples with the same timestamp can span chunks, so this is the last
+    # chunk starting before t rather than at or before it.
+    def first_chunk(self, t):
+        return max(bisect.bisect_left(self.chunk_t0, t) - 1, 0)
+
+    # Yields (timestamps, values) views for each chunk overlapping
+    # [t_start, t_end), in order. No data is copied.
+    def iter_range(self, t_start, t_end):
+        for idx in range(self.first_chunk(t_start), len(self.chunks)):
+            meta = self.chunks[idx]
+            if meta['t0'] >= t_end:
+                break
+            if meta['t1'] < t_start:
+                continue
+            ts, vals, _ = self.chunk(idx)
+            start = self.seek_in_chunk(idx, t_start) if meta['t0'] < t_start else 0
+            end = self.seek_in_chunk(idx, t_end) if meta['t1'] >= t_end else len(ts)
+            yield ts[start:end], vals[start:end]
+
+    # Reads all samples in [t_start, t_end). Returns views into the mapped
+    # chunk if the range falls in one chunk, otherwise a concatenated copy.
+    def read(self, t_start, t_end):
+        parts = list(self.iter_range(t_start, t_end))
+        if not parts:
+            return np.empty(0, np.int64), np.empty(0, self.dtype)
+        if len(parts) == 1:
+            return parts[0]
+        return (np.concatenate([p[0] for p in parts]),
+                np.concatenate([p[1] for p in parts]))
+
+    # Reads the summaries of the blocks holding samples in [t_start, t_end),
+    # for plotting a zoomed out view without reading the raw data, other than
+    # the one block searched at each end of the range. Returns the first
+    # timestamp, min and max of each block.
+    def summary(self, t_start, t_end):
+        parts = []
+        for idx in range(self.first_chunk(t_start), len(self.chunks)):
+            meta = self.chunks[idx]
+            if meta['t0'] >= t_end:
+                break
+            if meta['t1'] < t_start:
+                continue
+            start = self.seek_in_chunk(idx, t_start)
+            end = self.seek_in_chunk(idx, t_end)
+            if start < end:
+                summary = self.chunk(idx)[2]
+                parts.append(summary[start//BLOCK_LEN:(end - 1)//BLOCK_LEN + 1])
+        if not parts:
+            return np.empty(0, SUMMARY_DTYPE)
+        return parts[0] if len(parts) == 1 else np.concatenate(parts)
+
+
+# Read access to a whole recording.
+class Recording:
+    def __init__(self, root):
+        self.root = root
+        with open(os.path.join(root, INDEX_FILE)) as f:
+            index = json.load(f)
+        self.columns = {
+            name: Column(root, name, meta)
+            for name, meta in index['metrics'].items()
+        }
+
+    @property
+    def metrics(self):
+        return list(self.columns.keys())
+
+    def __getitem__(self, name):
+        return self.columns[name]
+
+
+# Creates the recording sinks for the log_data.py metric streams. Everything is
+# stored as floats, ext ADC channels included since decimated ext ADC samples
+# carry fractional counts (raw 12b counts are exact in a float32).
+def metric_sinks(writer, names):
+    return {name: writer.column(name, np.float32) for name in names}
+
+
+# Converts a captured device stream (raw event lines) into a recording.
+def convert(capture_path, root):
+    # Deferred so that reading recordings doesn't need the plotting
+    # dependencies log_data.py pulls in.
+    from log_data import METRIC_NAMES, decode_event_str
+
+    writer = RecordingWriter(root)
+    sinks = metric_sinks(writer, METRIC_NAMES)
+    with open(capture_path) as f:
+        for line in f:
+            decode_event_str(sinks, line.strip())
+    writer.close()
+
+
+# Times seeks, range reads, full scans and summary reads for every metric in a
+# recording.
+def bench(root, num_seeks, window_s):
+    rec = Recording(root)
+    rng = np.random.default_rng(0)
+    window_us = int(window_s*1000000)
+    for name in rec.metrics:
+        col = rec[name]
+        t_range = col.time_range()
+        if t_range is None:
+            continue
+        t0, t1 = t_range
+        starts = rng.integers(t0, max(t1 - window_us, t0 + 1), num_seeks)
+
+        # Warm up the mappings so we time reads rather than file opens.
+        for idx in range(len(col.chunks)):
+            col.chunk(idx)
+
+        begin = time.perf_counter()
+        for t in starts:
+            idx = max(bisect.bisect_right(col.chunk_t0, t) - 1, 0)
+            col.seek_in_chunk(idx, t)
+        seek_us = (time.perf_counter() - begin)/num_seeks*1e6
+
+        begin = time.perf_counter()
+        total = 0
+        for t in starts:
+            ts, vals = col.read(t, t + window_us)
+            total += float(vals.sum()) if len(vals) else 0.0
+        range_us = (time.perf_counter() - begin)/num_seeks*1e6
+
+        begin = time.perf_counter()
+        for t in starts:
+            col.summary(t, t + window_us)
+        summary_us = (time.perf_counter() - begin)/num_seeks*1e6
+
+        begin = time.perf_counter()
+        ts, vals = col.read(t0, t1 + 1)
+        float(vals.sum())
+        scan_ms = (time.perf_counter() - begin)*1000
+
+        print(f'{name}: {len(col)} samples, seek {seek_us:.1f}us, '
+              f'{window_s}s range {range_us:.1f}us, '
+              f'summary {summary_us:.1f}us, full scan {scan_ms:.1f}ms')
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description='Convert captures to columnar recordings and benchmark '
+                    'reading them.')
+    sub = parser.add_subparsers(dest='cmd', required=True)
+
+    p = sub.add_parser('convert', help='convert a raw event capture')
+    p.add_argument('capture', help='file of raw device event lines')
+    p.add_argument('recording', help='recording directory to create')
+
+    p = sub.add_parser('info', help='print the metrics in a recording')
+    p.add_argument('recording')
+
+    p = sub.add_parser('bench', help='benchmark seeks and range reads')
+    p.add_argument('recording')
+    p.add_argument('--seeks', type=int, default=1000)
+    p.add_argument('--window-s', type=float, default=1.0)
+    return parser.parse_args()
+
+
+def main():
+    args = parse_args()
+    if args.cmd == 'convert':
+        convert(args.capture, args.recording)
+    elif args.cmd == 'info':
+        rec = Recording(args.recording)
+        for name in rec.metrics:
+            col = rec[name]
+            print(f'{name}: {len(col)} samples, {len(col.chunks)} chunks, '
+                  f'{col.dtype}, time range {col.time_range()}')
+    elif args.cmd == 'bench':
+        bench(args.recording, args.seeks, args.window_s)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,3 +1,5 @@
+#include "pico/stdlib.h"
+
 #include "hardware/gpio.h"
 #include "hardware/adc.h"
 
@@ -23,7 +25,31 @@
 #define PT_ADC_CHANNEL 1
 #define FSR_ADC_CHANNEL 2
 
-void init_resistive_sensors(void) {
+// Time to let the active thermistor switch settle after switching it from
+// heating to the measurement source. The switch takes a few hundred ns, so 1us
+// is plenty.
+#define AT_SETTLE_US 1
+
+// Lookup tables built from the per-board calibration at startup, used to
+// convert the raw ADC readings in the sampling interrupt.
+static cal_lut_t at_lut;
+static cal_lut_t pt_lut;
+static cal_lut_t fsr_lut;
+
+// Latest active thermistor measurement. The active thermistor can only be
+// measured while it isn't heating, so it is measured by the temperature
+// controller at the start of each control period rather than in
+// read_resistive_sensors(), which just reports the latest measurement.
+static volatile uint16_t at_counts;
+static volatile int32_t at_mdeg_c;
+
+void init_resistive_sensors(const calibration_t* cal) {
+	// Build the conversion tables up front, this is the only place we do
+	// any of the expensive floating point calibration math.
+	build_therm_lut(&cal->active_therm, &at_lut);
+	build_therm_lut(&cal->passive_therm, &pt_lut);
+	build_fsr_lut(&cal->fsr, &fsr_lut);
+
 	// Configure pinmux for ADC inputs
 	adc_gpio_init(AT_ADC_PIN);
 	adc_gpio_init(PT_ADC_PIN);
@@ -52,34 +78,45 @@ void init_resistive_sensors(void) {
 	adc_run(false);
 }
 
-int read_resistive_sensors(res_sensor_sample_t* data) {
-	// 12-bit conversion, assume max value == ADC_VREF == 3.3 V
-	const float volts_conversion_factor = 3.3f / (1 << 12);
-
-	// First we switch the active thermistor into measure mode. It takes a
-	// few hundred ns to settle out, so by switching it here and reading it
-	// last, the delay caused by reading the other two channels allows the
-	// switch to settle.
-	set_active_therm_heat(false);
-
-	// Read all the channels and store the converted results in the sample.
+int __time_critical_func(read_resistive_sensors)(res_sensor_sample_t* data) {
+	// Read the channels and store the raw results in the sample.
 	//
 	// TODO: We could do some filtering here if noise is a problem.
 	//
 	// TODO: Per-channel calibration could be needed if ADC INL is bad.
 	adc_select_input(FSR_ADC_CHANNEL);
-	data->fsr_volts = adc_read() * volts_conversion_factor;
+	data->fsr_counts = adc_read();
 
 	adc_select_input(PT_ADC_CHANNEL);
-	data->passive_therm_volts = adc_read() * volts_conversion_factor;
+	data->passive_therm_counts = adc_read();
 
-	adc_select_input(AT_ADC_CHANNEL);
-	data->active_therm_volts = adc_read() * volts_conversion_factor;
+	// Convert to calibrated units, just a table lookup each.
+	data->fsr_mn = cal_lut_lookup(&fsr_lut, data->fsr_counts);
+	data->passive_therm_mdeg_c =
+		cal_lut_lookup(&pt_lut, data->passive_therm_counts);
+
+	// The active thermistor was already measured by the controller.
+	data->active_therm_counts = at_counts;
+	data->active_therm_mdeg_c = at_mdeg_c;
 
 	return 0;
 }
 
-void set_active_therm_heat(bool heat) {
+int32_t __time_critical_func(measure_active_therm)(void) {
+	// Switch the active thermistor into measure mode, and select the ADC
+	// channel while the switch settles.
+	set_active_therm_heat(false);
+	adc_select_input(AT_ADC_CHANNEL);
+	busy_wait_us_32(AT_SETTLE_US);
+
+	const uint16_t counts = adc_read();
+	const int32_t mdeg_c = cal_lut_lookup(&at_lut, counts);
+	at_counts = counts;
+	at_mdeg_c = mdeg_c;
+	return mdeg_c;
+}
+
+void __time_critical_func(set_active_therm_heat)(bool heat) {
 	if (heat) {
 		gpio_put(SW_SEL_PIN, 0);
 	} else {
@@ -10,31 +10,52 @@
 // switching behavior to heat it or measure it, that functionality is
 // also provided here.
 
+#include <stdbool.h>
+#include <stdint.h>
 
-// Holds the sample data for the resistive sensors.
-//
-// TODO: convert from volts to degrees and maybe force internally using
-// per-board calibration data.
+#include "calibration.h"
+
+// Holds the sample data for the resistive sensors. The raw 12b ADC counts are
+// kept alongside the calibrated values so that the host can still see volts,
+// and so calibration routines can be run against the raw readings.
 typedef struct res_sensor_sample {
-	float active_therm_volts;
-	float passive_therm_volts;
-	float fsr_volts;
+	// The active thermistor values are the latest measurement by
+	// measure_active_therm(), up to one control period old, see EVENT_RES.
+	uint16_t active_therm_counts;
+	uint16_t passive_therm_counts;
+	uint16_t fsr_counts;
+
+	// Calibrated values in fixed-point milli-degrees C and milli-Newtons.
+	int32_t active_therm_mdeg_c;
+	int32_t passive_therm_mdeg_c;
+	int32_t fsr_mn;
 } res_sensor_sample_t;
 
+// Converts raw internal ADC counts to volts. 12-bit conversion, assume max
+// value == ADC_VREF == 3.3 V.
+static inline float res_sensor_counts_to_volts(uint16_t counts) {
+	return counts * (3.3f / (1 << 12));
+}
+
 // Initialize pins, internal ADC, and other hardware to read the resistive
-// sensors.
-void init_resistive_sensors(void);
+// sensors, and build the lookup tables used to convert the raw readings using
+// the given per-board calibration.
+void init_resistive_sensors(const calibration_t* cal);
 
 // Reads the resistive sensors and writes the data to the given sample struct.
+// The active thermistor fields hold the latest measurement taken by
+// measure_active_therm(), this never touches the heater.
 //
 // Returns 0 on success, non-zero on failure.
-//
-// NOTE: This will automatically stop heating on the active thermistor, since
-// it must be switched to measure mode during the measurement. It is left this
-// way for convenience - so that the main loop can re-enable it only if it is
-// needed.
 int read_resistive_sensors(res_sensor_sample_t* data);
 
+// Measures the active thermistor and returns its temperature in milli-degrees
+// C. This must switch the active thermistor to the measurement source, so it
+// stops heating, and is left that way - the temperature controller calls this
+// at the start of each control period and then re-enables heating for as long
+// as it needs to.
+int32_t measure_active_therm(void);
+
 // Toggles heating on the active thermistor - if heat is true, it will be
 // connected to 20V heating, otherwise it will be connected to the 3.3V
 // precision measurement source.
@@ -0,0 +1,200 @@
+import argparse
+import os
+import pty
+import random
+import signal
+import subprocess
+import sys
+import threading
+import time
+import tty
+
+# Tests aggregate_data.py end to end against simulated boards on ptys. Each
+# board's device clock has its own boot offset and drift from the host clock,
+# and every event is written at a known host time, so the aggregator's aligned
+# timestamps can be checked against the truth.
+#
+# The drift is exaggerated well past any real crystal, so an aggregator that
+# only tracked the offset would be off by tens of milliseconds by the end.
+
+# Exit code ctest treats as a skipped test.
+SKIP = 77
+
+# Events before this many seconds in are left out of the accuracy checks, the
+# clock model needs a couple of buckets before it can fit the drift.
+WARMUP_S = 3.0
+
+# Allowed error between an aligned timestamp and the time the event was
+# written, and between the drift recovered from the aligned timestamps and the
+# board's actual drift.
+MAX_ERROR_S = 0.005
+MAX_DRIFT_ERROR_PPM = 200.0
+
+failures = 0
+
+
+def check(cond, msg):
+    global failures
+    if not cond:
+        print(f'FAIL: {msg}')
+        failures += 1
+
+
+class Board:
+    def __init__(self, idx, rng):
+        self.idx = idx
+        self.boot_s = rng.uniform(1.0, 1000.0)
+        self.drift = rng.uniform(-0.01, 0.01)
+        self.master, self.slave = pty.openpty()
+        # No echo or newline translation, we only ever write to the master.
+        tty.setraw(self.slave)
+        self.path = os.ttyname(self.slave)
+        # Host time each event was written, by device timestamp.
+        self.written = {}
+
+    def dev_us(self, t):
+        return int((self.boot_s + t*(1.0 + self.drift)) * 1e6)
+
+
+# Writes events from all boards in one thread, interleaved in host time order,
+# recording the host time each one went out.
+def write_events(boards, rate, duration_s):
+    period_s = 1.0/len(boards)/rate
+    for board in boards:
+        # The aggregator discards the first line from a port.
+        os.write(board.master, b'boot\n')
+
+    start_s = time.monotonic()
+    n = 0
+    while True:
+        t = n*period_s
+        if t > duration_s:
+            break
+        board = boards[n % len(boards)]
+        delay = start_s + t - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+        now = time.monotonic()
+        dev_us = board.dev_us(now - start_s)
+        board.written[dev_us] = now
+        os.write(board.master, f'3,{dev_us},{n}\n'.encode())
+        n += 1
+    return start_s
+
+
+# Slope of the least squares line through (x, y) points.
+def slope(points):
+    n = len(points)
+    mean_x = sum(p[0] for p in points) / n
+    mean_y = sum(p[1] for p in points) / n
+    sxx = sum((p[0] - mean_x)**2 for p in points)
+    sxy = sum((p[0] - mean_x)*(p[1] - mean_y) for p in points)
+    return sxy/sxx
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('aggregator', help='path to aggregate_data.py')
+    parser.add_argument('--boards', type=int, default=16)
+    parser.add_argument('--rate', type=float, default=100,
+                        help='events/s per board')
+    parser.add_argument('--duration-s', type=float, default=8.0)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    try:
+        import serial  # noqa: F401
+    except ImportError:
+        print('pyserial not installed, skipping')
+        return SKIP
+
+    rng = random.Random(args.seed)
+    boards = [Board(idx, rng) for idx in range(args.boards)]
+    out_path = f'aggregate_data_test_{os.getpid()}.csv'
+
+    proc = subprocess.Popen(
+        [sys.executable, args.aggregator, '-o', out_path, '--stats-s', '0',
+         *[board.path for board in boards]],
+        stderr=subprocess.PIPE, text=True)
+
+    # Opening a port flushes anything already written to it, so wait for
+    # every port to be opened before starting.
+    stderr = []
+    opened = 0
+    while opened < len(boards):
+        line = proc.stderr.readline()
+        if not line:
+            break
+        stderr.append(line)
+        # Reader threads print concurrently, so lines can run together.
+        opened += line.count('Opening serial port')
+    if opened < len(boards):
+        proc.kill()
+        print(f'aggregator failed to start:\n{"".join(stderr)}')
+        return 1
+    stderr_thread = threading.Thread(
+        target=lambda: stderr.extend(proc.stderr), daemon=True)
+    stderr_thread.start()
+    time.sleep(0.5)
+
+    start_s = write_events(boards, args.rate, args.duration_s)
+
+    # Once the aggregator has gone idle, interrupting it flushes everything
+    # still held for reordering.
+    time.sleep(1.0)
+    proc.send_signal(signal.SIGINT)
+    ret = proc.wait(timeout=10)
+    stderr_thread.join(timeout=1)
+    check(ret == 0, f'aggregator exited with {ret}:\n{"".join(stderr)}')
+
+    with open(out_path) as f:
+        lines = f.readlines()
+    os.remove(out_path)
+
+    total = sum(len(board.written) for board in boards)
+    check(len(lines) == total,
+          f'{len(lines)} events out of the aggregator, {total} written')
+
+    last_t = float('-inf')
+    out_of_order = 0
+    aligned = [[] for _ in boards]
+    for line in lines:
+        t, idx, _, dev_us, _ = line.split(',')
+        t = float(t)
+        if t < last_t:
+            out_of_order += 1
+        last_t = max(t, last_t)
+        aligned[int(idx)].append((int(dev_us), t))
+    check(out_of_order == 0, f'{out_of_order} events out of order')
+
+    for board in boards:
+        events = [(dev_us, t, board.written[dev_us])
+                  for dev_us, t in aligned[board.idx]
+                  if board.written[dev_us] - start_s > WARMUP_S]
+        if not events:
+            check(False, f'board {board.idx}: no events after warm up')
+            continue
+
+        max_error = max(abs(t - host_s) for _, t, host_s in events)
+        # The aligned timestamps are in host seconds, so the slope against
+        # the device timestamps gives back the device clock's rate.
+        drift = 1.0/slope([(dev_us/1e6, t) for dev_us, t, _ in events]) - 1.0
+        drift_error_ppm = abs(drift - board.drift)*1e6
+        print(f'board {board.idx}: drift {board.drift*1e6:.0f}ppm, '
+              f'recovered {drift*1e6:.0f}ppm, max error '
+              f'{max_error*1000:.2f}ms over {len(events)} events')
+        check(max_error <= MAX_ERROR_S,
+              f'board {board.idx}: max error {max_error*1000:.2f}ms')
+        check(drift_error_ppm <= MAX_DRIFT_ERROR_PPM,
+              f'board {board.idx}: drift off by {drift_error_ppm:.0f}ppm')
+
+    if failures:
+        print(f'{failures} checks failed')
+        return 1
+    print('all checks passed')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,261 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "calibration.h"
+#include "test_util.h"
+
+// Tests the resistive sensor calibration: the fixed-point lookup tables
+// against the floating point conversions they stand in for, and the
+// calibration file parsing and loading.
+
+#define ADC_COUNTS 4096
+
+// Temperature range the thermistor tables have to be accurate over, in degrees
+// C, and the allowed interpolation error there in milli-degrees C. Outside of
+// it the tables only have to stay within the rails.
+#define THERM_TEST_MIN_C (-20.0)
+#define THERM_TEST_MAX_C 120.0
+#define MAX_THERM_ERROR_MDEG_C 50.0
+
+// Allowed FSR table interpolation error below the rail, in milli-Newtons.
+#define MAX_FSR_ERROR_MN 100.0
+
+// Steinhart-Hart in double precision, in milli-degrees C.
+static double therm_mdeg_c(const therm_cal_t* cal, int counts) {
+	const double r = cal->series_ohms * (ADC_COUNTS - counts) / counts;
+	const double ln_r = log(r);
+	const double inv_t = cal->sh_a + cal->sh_b*ln_r + cal->sh_c*ln_r*ln_r*ln_r;
+	return (1.0/inv_t - 273.15) * 1000.0;
+}
+
+// The FSR force fit in double precision, in milli-Newtons, without the rails.
+static double fsr_mn(const fsr_cal_t* cal, int counts) {
+	const double r = cal->series_ohms * (ADC_COUNTS - counts) / counts;
+	return (cal->offset_newtons + cal->newtons_per_us * 1.0e6 / r) * 1000.0;
+}
+
+static void test_therm_lut(const char* name, const therm_cal_t* cal) {
+	cal_lut_t lut;
+	build_therm_lut(cal, &lut);
+
+	double max_error = 0.0;
+	int max_error_counts = 0;
+	int tested = 0;
+	int32_t last = THERM_MIN_MDEG_C;
+	for (int counts = 1; counts < ADC_COUNTS; counts++) {
+		const int32_t got = cal_lut_lookup(&lut, counts);
+		CHECK(got >= THERM_MIN_MDEG_C && got <= THERM_MAX_MDEG_C,
+				"%s: %d counts gave %d mC, outside the rails",
+				name, counts, got);
+		CHECK(got >= last, "%s: not monotonic at %d counts", name, counts);
+		last = got;
+
+		const double want = therm_mdeg_c(cal, counts);
+		if (want < THERM_TEST_MIN_C * 1000.0 ||
+				want > THERM_TEST_MAX_C * 1000.0) {
+			continue;
+		}
+		tested++;
+		const double error = fabs(got - want);
+		if (error > max_error) {
+			max_error = error;
+			max_error_counts = counts;
+		}
+	}
+	printf("%s: max error %.1f mC at %d counts over %d counts\n",
+			name, max_error, max_error_counts, tested);
+	CHECK(tested > ADC_COUNTS / 2, "%s: only %d counts in the test range",
+			name, tested);
+	CHECK(max_error <= MAX_THERM_ERROR_MDEG_C,
+			"%s: max error %.1f mC at %d counts", name, max_error,
+			max_error_counts);
+}
+
+static void test_fsr_lut(const char* name, const fsr_cal_t* cal) {
+	cal_lut_t lut;
+	build_fsr_lut(cal, &lut);
+
+	CHECK(cal_lut_lookup(&lut, 0) == 0, "%s: open circuit isn't 0 mN", name);
+	CHECK(cal_lut_lookup(&lut, ADC_COUNTS - 1) == FSR_MAX_MN,
+			"%s: full scale gave %d mN, expected the %d mN rail",
+			name, cal_lut_lookup(&lut, ADC_COUNTS - 1), FSR_MAX_MN);
+
+	double max_error = 0.0;
+	int railed_from = -1;
+	int32_t last = 0;
+	for (int counts = 1; counts < ADC_COUNTS; counts++) {
+		const int32_t got = cal_lut_lookup(&lut, counts);
+		CHECK(got >= 0 && got <= FSR_MAX_MN,
+				"%s: %d counts gave %d mN, outside the rails",
+				name, counts, got);
+		CHECK(got >= last, "%s: not monotonic at %d counts", name, counts);
+		last = got;
+
+		// Compare against the fit away from the segments the rail
+		// bends, where the table is a straight interpolation.
+		const int seg = counts >> CAL_LUT_SHIFT;
+		const int seg_end = (seg + 1) << CAL_LUT_SHIFT;
+		if (seg == 0 || fsr_mn(cal, seg_end) > FSR_MAX_MN) {
+			if (got == FSR_MAX_MN && railed_from < 0) {
+				railed_from = counts;
+			}
+			continue;
+		}
+		const double error = fabs(got - fsr_mn(cal, counts));
+		if (error > max_error) {
+			max_error = error;
+		}
+	}
+	printf("%s: max error %.1f mN, railed from %d counts\n",
+			name, max_error, railed_from);
+	CHECK(max_error <= MAX_FSR_ERROR_MN, "%s: max error %.1f mN",
+			name, max_error);
+	CHECK(railed_from > 0, "%s: never reached the rail", name);
+}
+
+static void test_parse_valid(void) {
+	calibration_t cal;
+	calibration_defaults(&cal);
+	const char* text =
+		"# Board 3, calibrated 2022-06-14\n"
+		"\n"
+		"at_series_ohms 9950\n"
+		"at_sh_a 1.1e-3\n"
+		"at_sh_b 2.4e-4\n"
+		"at_sh_c 2.1e-7\n"
+		"  pt_series_ohms   10050\r\n"
+		"pt_sh_a 1.2e-3\n"
+		"pt_sh_b 2.5e-4\n"
+		"pt_sh_c 2.2e-7\n"
+		"fsr_series_ohms 4700\n"
+		"fsr_newtons_per_us 0.25\n"
+		"fsr_offset_newtons -0.5";
+	CHECK(parse_calibration(&cal, text) == 0, "valid file failed to parse");
+	CHECK(cal.active_therm.series_ohms == 9950.0f, "at_series_ohms %g",
+			cal.active_therm.series_ohms);
+	CHECK(cal.active_therm.sh_a == 1.1e-3f, "at_sh_a %g",
+			cal.active_therm.sh_a);
+	CHECK(cal.active_therm.sh_b == 2.4e-4f, "at_sh_b %g",
+			cal.active_therm.sh_b);
+	CHECK(cal.active_therm.sh_c == 2.1e-7f, "at_sh_c %g",
+			cal.active_therm.sh_c);
+	CHECK(cal.passive_therm.series_ohms == 10050.0f, "pt_series_ohms %g",
+			cal.passive_therm.series_ohms);
+	CHECK(cal.passive_therm.sh_a == 1.2e-3f, "pt_sh_a %g",
+			cal.passive_therm.sh_a);
+	CHECK(cal.passive_therm.sh_b == 2.5e-4f, "pt_sh_b %g",
+			cal.passive_therm.sh_b);
+	CHECK(cal.passive_therm.sh_c == 2.2e-7f, "pt_sh_c %g",
+			cal.passive_therm.sh_c);
+	CHECK(cal.fsr.series_ohms == 4700.0f, "fsr_series_ohms %g",
+			cal.fsr.series_ohms);
+	CHECK(cal.fsr.newtons_per_us == 0.25f, "fsr_newtons_per_us %g",
+			cal.fsr.newtons_per_us);
+	CHECK(cal.fsr.offset_newtons == -0.5f, "fsr_offset_newtons %g",
+			cal.fsr.offset_newtons);
+}
+
+static void test_parse_partial(void) {
+	calibration_t cal;
+	calibration_t defaults;
+	calibration_defaults(&defaults);
+	calibration_defaults(&cal);
+	CHECK(parse_calibration(&cal, "at_sh_b 2.4e-4\n") == 0,
+			"partial file failed to parse");
+	CHECK(cal.active_therm.sh_b == 2.4e-4f, "at_sh_b %g",
+			cal.active_therm.sh_b);
+
+	// Everything else keeps its default.
+	cal.active_therm.sh_b = defaults.active_therm.sh_b;
+	CHECK(memcmp(&cal, &defaults, sizeof(cal)) == 0,
+			"partial file changed other keys");
+
+	calibration_defaults(&cal);
+	CHECK(parse_calibration(&cal, "") == 0, "empty file failed to parse");
+	CHECK(parse_calibration(&cal, "# just a comment\n\n") == 0,
+			"comment only file failed to parse");
+	CHECK(memcmp(&cal, &defaults, sizeof(cal)) == 0,
+			"empty file changed keys");
+}
+
+static void test_parse_malformed(void) {
+	calibration_t defaults;
+	calibration_defaults(&defaults);
+
+	const char* bad_lines[] = {
+		"at_sh_q 1.0\n",
+		"at_series_ohms\n",
+		"at_series_ohms ten\n",
+		"this line is far too long to fit in the parser's line buffer, "
+			"so it can't be trusted to be the key it looks like\n",
+	};
+	for (size_t i = 0; i < sizeof(bad_lines)/sizeof(bad_lines[0]); i++) {
+		calibration_t cal;
+		calibration_defaults(&cal);
+		CHECK(parse_calibration(&cal, bad_lines[i]) != 0,
+				"malformed line %zu parsed", i);
+		CHECK(memcmp(&cal, &defaults, sizeof(cal)) == 0,
+				"malformed line %zu changed keys", i);
+	}
+
+	// Well formed lines still apply around a bad one.
+	calibration_t cal;
+	calibration_defaults(&cal);
+	CHECK(parse_calibration(&cal,
+			"at_series_ohms 9950\nbogus\nfsr_newtons_per_us 0.25\n") != 0,
+			"file with a malformed line parsed");
+	CHECK(cal.active_therm.series_ohms == 9950.0f,
+			"line before the bad one not applied");
+	CHECK(cal.fsr.newtons_per_us == 0.25f,
+			"line after the bad one not applied");
+}
+
+static void test_load(void) {
+	calibration_t defaults;
+	calibration_defaults(&defaults);
+	calibration_t cal;
+
+	CHECK(load_calibration(&cal, NULL) == 0, "no file failed to load");
+	CHECK(memcmp(&cal, &defaults, sizeof(cal)) == 0,
+			"no file isn't the defaults");
+	CHECK(load_calibration(&cal, "") == 0, "empty file failed to load");
+	CHECK(memcmp(&cal, &defaults, sizeof(cal)) == 0,
+			"empty file isn't the defaults");
+
+	CHECK(load_calibration(&cal, "fsr_newtons_per_us 0.25\n") == 0,
+			"valid file failed to load");
+	CHECK(cal.fsr.newtons_per_us == 0.25f, "valid file not applied");
+
+	// A file with any bad line is ignored entirely.
+	CHECK(load_calibration(&cal, "fsr_newtons_per_us 0.25\nbogus\n") != 0,
+			"malformed file loaded");
+	CHECK(memcmp(&cal, &defaults, sizeof(cal)) == 0,
+			"malformed file didn't fall back to the defaults");
+}
+
+int main(void) {
+	calibration_t cal;
+	calibration_defaults(&cal);
+	test_therm_lut("default thermistor", &cal.active_therm);
+
+	// A thermistor with a 4.7k series resistor, shifting the curve across
+	// the ADC range.
+	therm_cal_t therm = cal.active_therm;
+	therm.series_ohms = 4700.0f;
+	test_therm_lut("4.7k series thermistor", &therm);
+
+	test_fsr_lut("default FSR", &cal.fsr);
+
+	// A stiffer fit that reaches the rail much earlier.
+	fsr_cal_t fsr = cal.fsr;
+	fsr.newtons_per_us = 1.0f;
+	test_fsr_lut("1 N/uS FSR", &fsr);
+
+	test_parse_valid();
+	test_parse_partial();
+	test_parse_malformed();
+	test_load();
+
+	return test_result();
+}
@@ -0,0 +1,163 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "decim_filter.h"
+#include "test_util.h"
+
+// Golden test for the fixed-point ext ADC decimation filter, checking it
+// against a double precision reference for every supported ratio: the CIC as
+// three cascaded R sample moving averages, followed by the ideal [b, 1 - 2b, b]
+// compensator.
+
+// Max allowed difference from the reference, in ADC counts. The filter rounds
+// to 1/2^DECIM_FRAC_BITS counts at the CIC output and again at the FIR output.
+#define MAX_ERROR_COUNTS 0.1
+
+// Max allowed difference between the measured impulse response centroid and
+// decim_filter_delay_x2(), in input samples.
+#define MAX_DELAY_ERROR 0.05
+
+#define NUM_INPUTS 4096
+#define ADC_MIN (-2048)
+#define ADC_MAX 2047
+
+// Impulse response of the reference CIC, normalized to unity DC gain. Returns
+// its length, 3*(ratio - 1) + 1.
+static int cic_response(int ratio, double* h) {
+	double box[3*(1 << DECIM_MAX_RATIO_LOG2)];
+	int len = 1;
+	h[0] = 1.0;
+	for (int stage = 0; stage < DECIM_CIC_ORDER; stage++) {
+		for (int i = 0; i < len + ratio - 1; i++) {
+			box[i] = 0.0;
+			for (int j = 0; j < ratio; j++) {
+				if (i - j >= 0 && i - j < len) {
+					box[i] += h[i - j] / ratio;
+				}
+			}
+		}
+		len += ratio - 1;
+		for (int i = 0; i < len; i++) {
+			h[i] = box[i];
+		}
+	}
+	return len;
+}
+
+// Runs the inputs through the reference filter, writing one output per ratio
+// inputs in ADC counts. Returns the number of outputs.
+static int reference_filter(int ratio_log2, const int32_t* in, int num_in, double* out) {
+	const int ratio = 1 << ratio_log2;
+	const double b = -DECIM_CIC_ORDER * (1.0 - 1.0 / ((double)ratio * ratio)) / 24.0;
+	double h[3*(1 << DECIM_MAX_RATIO_LOG2)];
+	const int len = cic_response(ratio, h);
+
+	double cic_hist[2] = {0.0, 0.0};
+	int num_out = 0;
+	for (int i = ratio - 1; i < num_in; i += ratio) {
+		double cic = 0.0;
+		for (int j = 0; j < len && j <= i; j++) {
+			cic += h[j] * in[i - j];
+		}
+		out[num_out++] = b * (cic + cic_hist[1]) + (1.0 - 2.0*b) * cic_hist[0];
+		cic_hist[1] = cic_hist[0];
+		cic_hist[0] = cic;
+	}
+	return num_out;
+}
+
+// Runs the inputs through a freshly initialized filter, writing its outputs
+// converted to ADC counts. Returns the number of outputs.
+static int run_filter(int ratio_log2, const int32_t* in, int num_in, double* out) {
+	decim_filter_t filt;
+	init_decim_filter(&filt, ratio_log2);
+	int num_out = 0;
+	for (int i = 0; i < num_in; i++) {
+		int32_t y;
+		if (decim_filter_push(&filt, in[i], &y)) {
+			out[num_out++] = y / (double)(1 << DECIM_FRAC_BITS);
+		}
+	}
+	return num_out;
+}
+
+// Checks the filter against the reference for one input signal.
+static void check_signal(const char* name, int ratio_log2, const int32_t* in) {
+	static double got[NUM_INPUTS];
+	static double want[NUM_INPUTS];
+	const int num_got = run_filter(ratio_log2, in, NUM_INPUTS, got);
+	const int num_want = reference_filter(ratio_log2, in, NUM_INPUTS, want);
+	CHECK(num_got == num_want, "ratio 2^%d %s: %d outputs, expected %d",
+			ratio_log2, name, num_got, num_want);
+
+	double max_error = 0.0;
+	for (int i = 0; i < num_got && i < num_want; i++) {
+		const double error = fabs(got[i] - want[i]);
+		if (error > max_error) {
+			max_error = error;
+		}
+	}
+	printf("ratio 2^%d %s: max error %.4f counts\n", ratio_log2, name, max_error);
+	CHECK(max_error <= MAX_ERROR_COUNTS, "ratio 2^%d %s: max error %.4f counts",
+			ratio_log2, name, max_error);
+}
+
+// Measures the filter's group delay as the centroid of its impulse response,
+// in input samples. An impulse at each of the ratio input phases is pushed
+// through, so together the decimated outputs sample the whole response.
+static double measure_delay(int ratio_log2) {
+	const int ratio = 1 << ratio_log2;
+	const int num_in = 8 * ratio;
+	double num = 0.0;
+	double den = 0.0;
+	for (int phase = 0; phase < ratio; phase++) {
+		decim_filter_t filt;
+		init_decim_filter(&filt, ratio_log2);
+		for (int i = 0; i < num_in; i++) {
+			int32_t y;
+			if (decim_filter_push(&filt, i == phase ? ADC_MAX : 0, &y)) {
+				// Outputs come out as the last input of each block
+				// is pushed.
+				num += (double)y * (i - phase);
+				den += y;
+			}
+		}
+	}
+	return num / den;
+}
+
+int main(void) {
+	static int32_t in[NUM_INPUTS];
+	srand(1);
+
+	for (int ratio_log2 = 0; ratio_log2 <= DECIM_MAX_RATIO_LOG2; ratio_log2++) {
+		for (int i = 0; i < NUM_INPUTS; i++) {
+			in[i] = ADC_MIN + rand() % (ADC_MAX - ADC_MIN + 1);
+		}
+		check_signal("random", ratio_log2, in);
+
+		// Full scale steps and a full scale square wave at the input
+		// Nyquist rate, the worst cases for the CIC's bit growth.
+		for (int i = 0; i < NUM_INPUTS; i++) {
+			in[i] = i < NUM_INPUTS/2 ? ADC_MAX : ADC_MIN;
+		}
+		check_signal("full scale step", ratio_log2, in);
+		for (int i = 0; i < NUM_INPUTS; i++) {
+			in[i] = i % 2 ? ADC_MAX : ADC_MIN;
+		}
+		check_signal("full scale square", ratio_log2, in);
+
+		const double delay = measure_delay(ratio_log2);
+		decim_filter_t filt;
+		init_decim_filter(&filt, ratio_log2);
+		const double expected = decim_filter_delay_x2(&filt) / 2.0;
+		printf("ratio 2^%d: delay %.4f samples, expected %.1f\n",
+				ratio_log2, delay, expected);
+		CHECK(fabs(delay - expected) <= MAX_DELAY_ERROR,
+				"ratio 2^%d: measured delay %.4f samples, expected %.1f",
+				ratio_log2, delay, expected);
+	}
+
+	return test_result();
+}
@@ -0,0 +1,165 @@
+import os
+import shutil
+import sys
+import tempfile
+
+# Round trip test for recording.py. Writes a metric spanning several chunks,
+# with runs of duplicate timestamps across block and chunk boundaries, reads it
+# back and checks random and edge case range reads and block summaries against
+# a plain numpy reference.
+
+# Exit code ctest treats as a skipped test.
+SKIP = 77
+
+try:
+    import numpy as np
+except ImportError:
+    print('numpy not installed, skipping')
+    sys.exit(SKIP)
+
+sys.path.insert(0, sys.argv[1] if len(sys.argv) > 1 else
+                os.path.join(os.path.dirname(__file__), '..'))
+import recording  # noqa: E402
+from recording import BLOCK_LEN, CHUNK_LEN  # noqa: E402
+
+NUM_SAMPLES = 300000
+NUM_RANGES = 2000
+
+failures = 0
+
+
+def check(cond, msg):
+    global failures
+    if not cond:
+        print(f'FAIL: {msg}')
+        failures += 1
+
+
+# Sorted timestamps with plenty of duplicates, plus long runs of one timestamp
+# straddling the first chunk boundary and a block boundary in the second chunk.
+def make_timestamps(rng):
+    steps = rng.integers(0, 3, NUM_SAMPLES)
+    steps[CHUNK_LEN - 300:CHUNK_LEN + 300] = 0
+    block_end = CHUNK_LEN + 10*BLOCK_LEN
+    steps[block_end - BLOCK_LEN - 20:block_end + 20] = 0
+    return 1000000 + np.cumsum(steps)
+
+
+# The (start, end) sample indices of every summary block. Blocks restart at
+# each chunk, so the last block of a chunk can be short.
+def blocks():
+    starts = []
+    ends = []
+    for chunk_start in range(0, NUM_SAMPLES, CHUNK_LEN):
+        chunk_end = min(chunk_start + CHUNK_LEN, NUM_SAMPLES)
+        for start in range(chunk_start, chunk_end, BLOCK_LEN):
+            starts.append(start)
+            ends.append(min(start + BLOCK_LEN, chunk_end))
+    return np.array(starts), np.array(ends)
+
+
+# The expected summary of every block: its sample indices, first timestamp,
+# min and max.
+class Blocks:
+    def __init__(self, ts, vals):
+        self.ts = ts
+        self.starts, self.ends = blocks()
+        self.first = ts[self.starts]
+        self.min = np.minimum.reduceat(vals, self.starts)
+        self.max = np.maximum.reduceat(vals, self.starts)
+
+    def __len__(self):
+        return len(self.starts)
+
+
+def check_read(col, ts, vals, t_start, t_end):
+    lo = np.searchsorted(ts, t_start, side='left')
+    hi = np.searchsorted(ts, t_end, side='left')
+    got_ts, got_vals = col.read(t_start, t_end)
+    if not (np.array_equal(got_ts, ts[lo:hi]) and
+            np.array_equal(got_vals, vals[lo:hi])):
+        check(False, f'read [{t_start}, {t_end}) gave {len(got_ts)} samples, '
+                     f'expected {hi - lo}')
+
+
+# Every block holding a sample in the range should be in the summary, and no
+# others.
+def check_summary(col, expected, t_start, t_end):
+    lo = np.searchsorted(expected.ts, t_start, side='left')
+    hi = np.searchsorted(expected.ts, t_end, side='left')
+    overlap = (expected.ends > lo) & (expected.starts < hi) & (lo < hi)
+    got = col.summary(t_start, t_end)
+    if not (np.array_equal(got['t'], expected.first[overlap]) and
+            np.array_equal(got['min'], expected.min[overlap]) and
+            np.array_equal(got['max'], expected.max[overlap])):
+        check(False, f'summary [{t_start}, {t_end}) gave {len(got)} blocks, '
+                     f'expected {overlap.sum()}')
+
+
+def main():
+    rng = np.random.default_rng(0)
+    ts = make_timestamps(rng)
+    vals = rng.standard_normal(NUM_SAMPLES).astype(np.float32)
+
+    root = tempfile.mkdtemp(prefix='recording_test_')
+    try:
+        writer = recording.RecordingWriter(root)
+        col = writer.column('EXT ADC 0')
+        for t, v in zip(ts.tolist(), vals.tolist()):
+            col.append(t, v)
+        writer.close()
+
+        rec = recording.Recording(root)
+        check(rec.metrics == ['EXT ADC 0'], f'metrics {rec.metrics}')
+        col = rec['EXT ADC 0']
+        num_chunks = (NUM_SAMPLES + CHUNK_LEN - 1) // CHUNK_LEN
+        check(len(col.chunks) == num_chunks,
+              f'{len(col.chunks)} chunks, expected {num_chunks}')
+        check(len(col) == NUM_SAMPLES, f'{len(col)} samples')
+        check(col.time_range() == (ts[0], ts[-1]),
+              f'time range {col.time_range()}')
+        check(col.dtype == np.float32, f'dtype {col.dtype}')
+
+        # The whole recording, and a range inside one chunk, which should
+        # come back as views into the mapped chunk.
+        check_read(col, ts, vals, ts[0], ts[-1] + 1)
+        t_mid = ts[CHUNK_LEN // 2]
+        _, got_vals = col.read(t_mid, t_mid + 100)
+        check(isinstance(got_vals, np.memmap),
+              'read within one chunk copied the data')
+
+        expected = Blocks(ts, vals)
+        check_summary(col, expected, ts[0], ts[-1] + 1)
+
+        # Ranges starting and ending on every chunk and block boundary
+        # timestamp, where the duplicate runs are, and off both ends.
+        edges = np.unique(np.concatenate([
+            [ts[0] - 10, ts[0], ts[-1], ts[-1] + 10],
+            ts[expected.starts], ts[expected.ends - 1],
+            ts[expected.ends - 1] + 1]))
+        for t in edges.tolist():
+            for t_end in (t, t + 1, t + 50, t + BLOCK_LEN*2):
+                check_read(col, ts, vals, t, t_end)
+                check_summary(col, expected, t, t_end)
+
+        # Random ranges, half of them starting on a sample's timestamp.
+        for i in range(NUM_RANGES):
+            if i % 2:
+                t_start = int(ts[rng.integers(NUM_SAMPLES)])
+            else:
+                t_start = int(rng.integers(ts[0] - 100, ts[-1] + 100))
+            t_end = t_start + int(rng.integers(0, 3*CHUNK_LEN))
+            check_read(col, ts, vals, t_start, t_end)
+            check_summary(col, expected, t_start, t_end)
+    finally:
+        shutil.rmtree(root)
+
+    if failures:
+        print(f'{failures} checks failed')
+        return 1
+    print('all checks passed')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
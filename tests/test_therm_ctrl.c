@@ -0,0 +1,134 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "therm_ctrl.h"
+#include "test_util.h"
+
+// Runs the active thermistor controller against a simulated first-order
+// thermal plant, with the same rate, gains and duty limit as hp_test.c.
+
+#define RATE_HZ 50
+#define PERIOD_US (1000000/RATE_HZ)
+#define GUARD_US 100
+
+// Plant: the thermistor relaxes towards ambient plus GAIN_C times the heater
+// duty with time constant TAU_S.
+#define AMBIENT_C 20.0
+#define GAIN_C 40.0
+#define TAU_S 5.0
+
+// Plant integration steps per control period, 20us each, so the heater
+// on-time is close to as finely resolved as the firmware's alarm.
+#define SUBSTEPS 1000
+
+// Stats from one run, see run().
+typedef struct run_stats {
+	double peak_c;
+	double trough_c;
+	double settle_s;
+	double final_c;
+	int32_t max_duty;
+	int32_t min_duty;
+} run_stats_t;
+
+// Runs the loop for duration_s from the plant temperature *temp_c, updating
+// it. Settling time is the last time the temperature was outside of
+// band_c of the setpoint.
+static run_stats_t run(therm_ctrl_t* ctrl, double* temp_c, double duration_s, double band_c) {
+	const double setpoint_c = ctrl->setpoint_mdeg_c / 1000.0;
+	const double dt = 1.0 / RATE_HZ / SUBSTEPS;
+	run_stats_t stats = {
+		.peak_c = *temp_c,
+		.trough_c = *temp_c,
+		.max_duty = INT32_MIN,
+		.min_duty = INT32_MAX,
+	};
+
+	const int periods = (int)(duration_s * RATE_HZ);
+	for (int i = 0; i < periods; i++) {
+		// The firmware measures with the LUT's milli-degree resolution.
+		therm_ctrl_sample_t sample;
+		therm_ctrl_update(ctrl, (int32_t)lround(*temp_c * 1000.0), &sample);
+		if (sample.duty > stats.max_duty) {
+			stats.max_duty = sample.duty;
+		}
+		if (sample.duty < stats.min_duty) {
+			stats.min_duty = sample.duty;
+		}
+
+		// Time-proportioned heater, on for the first duty fraction of the
+		// period.
+		const int on_steps = (int)(((int64_t)sample.duty * SUBSTEPS) / THERM_CTRL_DUTY_ONE);
+		for (int j = 0; j < SUBSTEPS; j++) {
+			const double heat_c = j < on_steps ? GAIN_C : 0.0;
+			*temp_c += (AMBIENT_C + heat_c - *temp_c) * dt / TAU_S;
+		}
+
+		if (*temp_c > stats.peak_c) {
+			stats.peak_c = *temp_c;
+		}
+		if (*temp_c < stats.trough_c) {
+			stats.trough_c = *temp_c;
+		}
+		if (fabs(*temp_c - setpoint_c) > band_c) {
+			stats.settle_s = (i + 1) / (double)RATE_HZ;
+		}
+	}
+	stats.final_c = *temp_c;
+	return stats;
+}
+
+int main(void) {
+	therm_ctrl_t ctrl = {
+		.setpoint_mdeg_c = 30000,
+		.kp = THERM_CTRL_DUTY_ONE / 4,
+		.ki = THERM_CTRL_DUTY_ONE / 20,
+		.max_duty = THERM_CTRL_DUTY_ONE -
+			(int32_t)(((int64_t)THERM_CTRL_DUTY_ONE * GUARD_US) / PERIOD_US),
+		.rate_hz = RATE_HZ,
+	};
+	init_therm_ctrl(&ctrl);
+
+	// Step from ambient up to the setpoint.
+	double temp_c = AMBIENT_C;
+	run_stats_t step = run(&ctrl, &temp_c, 120.0, 0.1);
+	printf("step: settle %.2fs, overshoot %.3fC, final %.4fC\n",
+			step.settle_s, step.peak_c - 30.0, step.final_c);
+	CHECK(step.settle_s < 20.0, "step settling time %.2fs", step.settle_s);
+	CHECK(step.peak_c - 30.0 < 0.1, "step overshoot %.3fC", step.peak_c - 30.0);
+	CHECK(fabs(step.final_c - 30.0) < 0.002, "step steady state error %.4fC", step.final_c - 30.0);
+	CHECK(step.max_duty <= ctrl.max_duty, "duty %d over max %d", step.max_duty, ctrl.max_duty);
+	CHECK(step.min_duty >= 0, "negative duty %d", step.min_duty);
+
+	// Drop the setpoint. The heater can't cool so the output saturates at
+	// zero while the plant drifts down, and the integral must not wind
+	// down with it or we'd undershoot badly on the way back.
+	ctrl.setpoint_mdeg_c = 25000;
+	run_stats_t drop = run(&ctrl, &temp_c, 120.0, 0.1);
+	printf("drop: settle %.2fs, undershoot %.3fC, final %.4fC\n",
+			drop.settle_s, 25.0 - drop.trough_c, drop.final_c);
+	CHECK(drop.settle_s < 20.0, "drop settling time %.2fs", drop.settle_s);
+	CHECK(25.0 - drop.trough_c < 0.1, "drop undershoot %.3fC", 25.0 - drop.trough_c);
+	CHECK(fabs(drop.final_c - 25.0) < 0.002, "drop steady state error %.4fC", drop.final_c - 25.0);
+	CHECK(drop.max_duty <= ctrl.max_duty, "duty %d over max %d", drop.max_duty, ctrl.max_duty);
+	CHECK(drop.min_duty >= 0, "negative duty %d", drop.min_duty);
+
+	// A setpoint the heater can't reach holds the output at max_duty, and
+	// anti-windup has to keep the integral from running away so the loop
+	// recovers promptly once the setpoint is reachable again.
+	ctrl.setpoint_mdeg_c = 80000;
+	run_stats_t unreachable = run(&ctrl, &temp_c, 60.0, 0.1);
+	CHECK(unreachable.max_duty <= ctrl.max_duty, "duty %d over max %d",
+			unreachable.max_duty, ctrl.max_duty);
+	ctrl.setpoint_mdeg_c = 30000;
+	run_stats_t recover = run(&ctrl, &temp_c, 120.0, 0.1);
+	printf("windup recovery: settle %.2fs, undershoot %.3fC, final %.4fC\n",
+			recover.settle_s, 30.0 - recover.trough_c, recover.final_c);
+	CHECK(recover.settle_s < 25.0, "windup recovery settling time %.2fs", recover.settle_s);
+	CHECK(30.0 - recover.trough_c < 0.5, "windup recovery undershoot %.3fC",
+			30.0 - recover.trough_c);
+	CHECK(fabs(recover.final_c - 30.0) < 0.002, "windup recovery steady state error %.4fC",
+			recover.final_c - 30.0);
+
+	return test_result();
+}
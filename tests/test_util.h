@@ -0,0 +1,33 @@
+#ifndef _TEST_UTIL_H
+#define _TEST_UTIL_H
+
+#include <stdio.h>
+
+// Minimal check helpers shared by the host tests. Each test is a single
+// translation unit, so every test gets its own failure count.
+
+static int failures = 0;
+
+// Records a failure with a printf style message if cond is false, and keeps
+// going so one run reports every failed check.
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+		failures++; \
+	} \
+} while (0)
+
+// Prints the summary and returns the exit code for main(), non-zero if any
+// check failed.
+static inline int test_result(void) {
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
+
+#endif // _TEST_UTIL_H
@@ -0,0 +1,61 @@
+#include <stdbool.h>
+
+#include "therm_ctrl.h"
+
+// The controller runs in the therm ctrl interrupt, so on the device it lives in
+// SRAM with the rest of the sampling path. It has no other hardware
+// dependencies, so off the device it builds as plain C for the host tests in
+// tests/.
+#if PICO_ON_DEVICE
+#include "pico.h"
+#else
+#define __time_critical_func(f) f
+#endif
+
+static inline int32_t clamp_duty(int32_t duty, int32_t max_duty) {
+	if (duty < 0) {
+		return 0;
+	}
+	if (duty > max_duty) {
+		return max_duty;
+	}
+	return duty;
+}
+
+void init_therm_ctrl(therm_ctrl_t* ctrl) {
+	ctrl->integral = 0;
+}
+
+void __time_critical_func(therm_ctrl_update)(therm_ctrl_t* ctrl,
+		int32_t measured_mdeg_c, therm_ctrl_sample_t* sample) {
+	const int32_t error = ctrl->setpoint_mdeg_c - measured_mdeg_c;
+
+	// Gains are per degree, the error is in milli-degrees, so scale down by
+	// 1000 (and by the rate for the integral term). Do the multiplies in 64b
+	// since a big error times a big gain can easily overflow 32b.
+	const int64_t integral_scale = 1000 * (int64_t)ctrl->rate_hz;
+	const int32_t p = (int32_t)(((int64_t)ctrl->kp * error) / 1000);
+	const int64_t di = (int64_t)ctrl->ki * error;
+
+	// Anti-windup: only integrate when it would not push the output
+	// further into saturation. The heater can't cool, so without this the
+	// integral winds up while overshooting and we overshoot even more.
+	const int32_t unclamped = p + (int32_t)(ctrl->integral / integral_scale);
+	const bool saturated_high = unclamped >= ctrl->max_duty && di > 0;
+	const bool saturated_low = unclamped <= 0 && di < 0;
+	if (!saturated_high && !saturated_low) {
+		ctrl->integral += di;
+		if (ctrl->integral < 0) {
+			ctrl->integral = 0;
+		}
+		if (ctrl->integral > ctrl->max_duty * integral_scale) {
+			ctrl->integral = ctrl->max_duty * integral_scale;
+		}
+	}
+
+	sample->setpoint_mdeg_c = ctrl->setpoint_mdeg_c;
+	sample->measured_mdeg_c = measured_mdeg_c;
+	sample->error_mdeg_c = error;
+	const int32_t i = (int32_t)(ctrl->integral / integral_scale);
+	sample->duty = clamp_duty(p + i, ctrl->max_duty);
+}
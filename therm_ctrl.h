@@ -0,0 +1,61 @@
+#ifndef _THERM_CTRL_H
+#define _THERM_CTRL_H
+
+#include <stdint.h>
+
+// Closed-loop temperature controller for the active thermistor. This is a
+// plain fixed-point PI loop with no hardware dependencies - the caller feeds it
+// a temperature measurement each control period and gets back a heater duty
+// cycle, which it is responsible for applying (we time-proportion the heater
+// switch). Keeping the hardware out of here means the exact same code can be
+// run against a simulated thermal plant on a host machine.
+//
+// Duty cycles are Q16 fixed-point fractions, where THERM_CTRL_DUTY_ONE is
+// 100% heating.
+#define THERM_CTRL_DUTY_ONE (1 << 16)
+
+// Controller instance data. Like the IMU, the config fields should be filled
+// out before calling init_therm_ctrl(), which resets the loop state.
+typedef struct therm_ctrl {
+	// Target temperature in milli-degrees C.
+	int32_t setpoint_mdeg_c;
+
+	// Proportional gain, in Q16 duty per degree C of error.
+	int32_t kp;
+
+	// Integral gain, in Q16 duty per degree C of error per second.
+	int32_t ki;
+
+	// Upper limit on the output duty cycle, in Q16. Lets us leave some
+	// headroom in each period for the measurement window.
+	int32_t max_duty;
+
+	// Rate at which therm_ctrl_update() is called, used to scale the
+	// integral term.
+	int32_t rate_hz;
+
+	// Loop state, the accumulated integral term in Q16 duty scaled up by
+	// 1000*rate_hz. Keeping the scale factor in the accumulator rather than
+	// dividing it out each update means small errors still integrate
+	// instead of truncating to zero and leaving a steady state offset.
+	int64_t integral;
+} therm_ctrl_t;
+
+// Controller telemetry from one control period, sent to the host so the loop
+// can be tuned.
+typedef struct therm_ctrl_sample {
+	int32_t setpoint_mdeg_c;
+	int32_t measured_mdeg_c;
+	int32_t error_mdeg_c;
+	int32_t duty;
+} therm_ctrl_sample_t;
+
+// Resets the controller loop state. Config fields must already be filled out.
+void init_therm_ctrl(therm_ctrl_t* ctrl);
+
+// Runs one control period given the latest temperature measurement, writing
+// the new heater duty cycle and the rest of the loop telemetry into the given
+// sample struct. Integer only, safe to call from an interrupt.
+void therm_ctrl_update(therm_ctrl_t* ctrl, int32_t measured_mdeg_c, therm_ctrl_sample_t* sample);
+
+#endif // _THERM_CTRL_H